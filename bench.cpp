@@ -0,0 +1,481 @@
+// tumblepop_bench: headless stress scenarios with machine-readable results.
+//
+//   g++ -std=c++17 -O2 bench.cpp -o tumblepop_bench -lsfml-graphics -lsfml-window -lsfml-audio -lsfml-system -pthread
+//
+//   tumblepop_bench [--ticks n] [--out file] [--baseline file] [--threshold 0.10]
+//                   [--level n | --level-file path] [--enemies n] [--script patrol|vacuum|random]
+//
+// Without --level/--level-file/--enemies/--script the built-in suite runs. Results go to
+// stdout (or --out) as JSON, one scenario per line so a baseline file is easy
+// to diff. With --baseline every ns/tick figure is compared against that file
+// and the exit code is 1 if any got slower by more than the threshold.
+
+// The counting operator new below is malloc-backed, which GCC's
+// -Wmismatched-new-delete can't see through when it inlines container frees.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+#define TUMBLEPOP_NO_MAIN
+#include "main.cpp"
+
+#include <new>
+#include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Every global new in the process, so the bench can report allocations per tick
+atomic<long long> benchAllocs{0};
+
+void *operator new(size_t size)
+{
+    benchAllocs.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Peak resident set size of the whole run so far
+long peak_rss_kb()
+{
+#if defined(__APPLE__)
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024; // bytes on macOS
+#elif defined(__unix__)
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+#else
+    return -1;
+#endif
+}
+
+// Starts a new peak for scenario_peak_rss_kb. False where that isn't possible
+// (anything but Linux, where writing 5 to clear_refs resets VmHWM).
+bool reset_peak_rss()
+{
+#if defined(__GLIBC__)
+    malloc_trim(0); // hand back what earlier scenarios freed, or it counts here
+#endif
+#if defined(__linux__)
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return (bool)clearRefs;
+#else
+    return false;
+#endif
+}
+
+// Peak resident set size since reset_peak_rss
+long scenario_peak_rss_kb()
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return atol(line.c_str() + 6);
+    return -1;
+}
+
+struct BenchScenario
+{
+    string name;
+    int level = 1;
+    int perType = 0; // extra enemies of each of the four types on top of the level's own
+    string script = "patrol";
+    unsigned seed = 1;
+};
+
+struct BenchResult
+{
+    long ticks = 0;
+    double nsPerTick = 0;
+    double allocsPerTick = 0;
+    long restarts = 0;
+    long peakRssKb = -1; // this scenario's, -1 where it can't be told apart from the process's
+    double phaseNsPerTick[PROF_PHASES] = {};
+    // the timed pass also records every tick into a rewind buffer
+    double rewindNsPerTick = 0;
+    double rewindKb = 0;
+    double rewindArenaKb = 0; // grows until REWIND_SECONDS fit, see rewind_place
+    double rewindSeconds = 0;
+    long rewindEarlyDrops = 0; // > 0: the history fell short of REWIND_SECONDS
+};
+
+// Level plus perType enemies of every type on random valid cells. The bench
+// player can't run out of lives, so a scenario only ends when the level is cleared.
+void setup_scenario(GameState &gs, const BenchScenario &sc)
+{
+    newGame(gs, sc.level, sc.seed);
+    gs.lifeCount = 1 << 30;
+
+    for (int type = 0; type < 4; type++)
+    {
+        for (int k = 0; k < sc.perType; k++)
+        {
+            int row = sim_rand(gs.rng) % gs.height;
+            int col = sim_rand(gs.rng) % gs.width;
+            findValidSpawn(gs.lvl, row, col, type);
+            EnemyHandle h = enemy_add(gs.enemies, type, col * gs.cell_size, row * gs.cell_size);
+            grid_update(gs.enemyGrid, gs.enemies, enemy_index(gs.enemies, h));
+        }
+    }
+}
+
+// patrol: walk right and left for 1.5 s each, jumping every 0.75 s
+// vacuum: patrol with the vacuum held, a single throw every second and a bulk throw every 4 s
+// random: the headless soak's button mashing
+GameInput bench_input(const string &script, long t, InputSource &rnd)
+{
+    GameInput in;
+    if (script == "random")
+    {
+        next_input(rnd, in);
+        return in;
+    }
+
+    in.movingRight = (t / 90) % 2 == 0;
+    in.movingLeft = !in.movingRight;
+    in.pressingJump = t % 45 == 0;
+    if (script == "vacuum")
+    {
+        in.vacuum = t % 60 < 50;
+        in.throwKey = t % 60 == 55;
+        in.bulkThrow = t % 240 == 230;
+    }
+    return in;
+}
+
+// Ticks played before measuring, so the scratch buffers have grown to size
+const int BENCH_WARMUP_TICKS = 60;
+
+// One pass over the scenario. timed = phase timers on, which costs a little,
+// so the total ns/tick comes from an untimed pass. The timed pass also feeds a
+// rewind buffer, outside of the simulation phases. Only steady-state ticks
+// count: the warm-up and the setup after a cleared level are taken out of the
+// time and the allocations.
+BenchResult run_scenario(const BenchScenario &sc, long ticks, bool timed)
+{
+    BenchResult r;
+    r.ticks = ticks;
+    bool rssScoped = !timed && reset_peak_rss();
+
+    GameState gs;
+    setup_scenario(gs, sc);
+    RewindBuffer rewind;
+    if (timed)
+        rewind_init(rewind, gs.tickDt);
+
+    srand(sc.seed);
+    InputSource rnd;
+    rnd.mode = INPUT_RANDOM;
+
+    long t = 0;
+    for (; t < BENCH_WARMUP_TICKS; t++)
+    {
+        stepGame(gs, bench_input(sc.script, t, rnd));
+        gs.levelChanged = false;
+        if (gs.gameState == 0)
+            setup_scenario(gs, sc);
+    }
+
+    for (int p = 0; p < PROF_PHASES; p++)
+        profiler.phaseNs[p] = 0;
+    profiler.enabled = timed;
+
+    double setupNs = 0;
+    long long setupAllocs = 0;
+    long long allocsBefore = benchAllocs.load();
+    auto begin = chrono::steady_clock::now();
+    for (long end = t + ticks; t < end; t++)
+    {
+        stepGame(gs, bench_input(sc.script, t, rnd));
+        gs.levelChanged = false;
+        if (timed)
+            rewind_push(rewind, gs);
+
+        if (gs.gameState == 0)
+        {
+            r.restarts++;
+            long long a0 = benchAllocs.load();
+            auto t0 = chrono::steady_clock::now();
+            setup_scenario(gs, sc);
+            setupNs += chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+            setupAllocs += benchAllocs.load() - a0;
+        }
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() - setupNs;
+    long long allocs = benchAllocs.load() - allocsBefore - setupAllocs;
+
+    profiler.enabled = false;
+    if (rssScoped)
+        r.peakRssKb = scenario_peak_rss_kb();
+
+    r.nsPerTick = ns / ticks;
+    r.allocsPerTick = (double)allocs / ticks;
+    for (int p = 0; p < PROF_PHASES; p++)
+        r.phaseNsPerTick[p] = (double)profiler.phaseNs[p] / ticks;
+    if (timed)
+    {
+        r.rewindNsPerTick = (double)rewind.encodeNs / rewind.pushes;
+        r.rewindKb = rewind.usedBytes / 1024.0;
+        r.rewindArenaKb = rewind.arena.size() / 1024.0;
+        r.rewindSeconds = rewind.count * gs.tickDt;
+        r.rewindEarlyDrops = rewind.earlyDrops;
+    }
+    return r;
+}
+
+// Simulation phases reported per scenario, JSON keys derived from profPhaseNames
+const int benchPhases[] = {PROF_SIM, PROF_PLAYER, PROF_ENEMIES, PROF_STUCK, PROF_GENOVA, PROF_VACUUM, PROF_THROWN, PROF_PROJECTILES};
+
+string phase_key(int p)
+{
+    string key;
+    for (const char *c = profPhaseNames[p]; *c; c++)
+    {
+        if (*c != ' ')
+            key += *c;
+        else if (!key.empty())
+            key += '_';
+    }
+    return key + "_ns";
+}
+
+string scenario_json(const BenchScenario &sc, const BenchResult &r)
+{
+    ostringstream out;
+    out << "{\"name\": \"" << sc.name << "\", \"level\": " << sc.level
+        << ", \"enemies_per_type\": " << sc.perType << ", \"script\": \"" << sc.script
+        << "\", \"ticks\": " << r.ticks << ", \"restarts\": " << r.restarts << ", \"peak_rss_kb\": " << r.peakRssKb
+        << ", \"ns_per_tick\": " << r.nsPerTick << ", \"allocs_per_tick\": " << r.allocsPerTick
+        << ", \"rewind_ns\": " << r.rewindNsPerTick << ", \"rewind_kb\": " << r.rewindKb
+        << ", \"rewind_arena_kb\": " << r.rewindArenaKb << ", \"rewind_seconds\": " << r.rewindSeconds
+        << ", \"rewind_early_drops\": " << r.rewindEarlyDrops
+        << ", \"subsystems_per_tick\": {";
+    for (size_t k = 0; k < sizeof(benchPhases) / sizeof(benchPhases[0]); k++)
+    {
+        if (k > 0)
+            out << ", ";
+        out << "\"" << phase_key(benchPhases[k]) << "\": " << r.phaseNsPerTick[benchPhases[k]];
+    }
+    out << "}}";
+    return out.str();
+}
+
+// Baseline files are earlier bench output. Only scenario lines matter: the
+// name and every "..._ns" / "ns_per_tick" number on the line.
+map<string, map<string, double>> load_baseline(const string &path)
+{
+    map<string, map<string, double>> base;
+    ifstream in(path);
+    string line;
+    while (getline(in, line))
+    {
+        size_t n = line.find("\"name\": \"");
+        if (n == string::npos)
+            continue;
+        n += 9;
+        string name = line.substr(n, line.find('"', n) - n);
+
+        size_t pos = 0;
+        while ((pos = line.find('"', pos)) != string::npos)
+        {
+            size_t end = line.find('"', pos + 1);
+            if (end == string::npos)
+                break;
+            string key = line.substr(pos + 1, end - pos - 1);
+            pos = end + 1;
+            if (key != "ns_per_tick" && (key.size() < 3 || key.compare(key.size() - 3, 3, "_ns") != 0))
+                continue;
+            if (line.compare(pos, 2, ": ") != 0)
+                continue;
+            base[name][key] = atof(line.c_str() + pos + 2);
+        }
+    }
+    return base;
+}
+
+// Prints every figure that moved past the threshold, returns the number of regressions.
+// Differences under 2 ns are noise and never count.
+int compare_baseline(const map<string, map<string, double>> &base, const BenchScenario &sc,
+                     const BenchResult &r, double threshold)
+{
+    auto it = base.find(sc.name);
+    if (it == base.end())
+    {
+        cerr << sc.name << ": not in baseline" << endl;
+        return 0;
+    }
+
+    map<string, double> now;
+    now["ns_per_tick"] = r.nsPerTick;
+    now["rewind_ns"] = r.rewindNsPerTick;
+    for (int p : benchPhases)
+        now[phase_key(p)] = r.phaseNsPerTick[p];
+
+    int regressions = 0;
+    for (const auto &kv : now)
+    {
+        auto b = it->second.find(kv.first);
+        if (b == it->second.end() || b->second <= 0)
+            continue;
+        double change = (kv.second - b->second) / b->second;
+        if (fabs(kv.second - b->second) < 2.0 || fabs(change) <= threshold)
+            continue;
+
+        cerr << (change > 0 ? "REGRESSION " : "improved   ") << sc.name << " " << kv.first << ": "
+             << b->second << " -> " << kv.second << " ns (" << (change > 0 ? "+" : "") << change * 100 << "%)" << endl;
+        if (change > 0)
+            regressions++;
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    long ticks = 5000;
+    string outPath;
+    string baselinePath;
+    double threshold = 0.10;
+    BenchScenario custom;
+    custom.name = "custom";
+    bool useCustom = false;
+    string levelFile;
+
+    for (int a = 1; a + 1 < argc; a++)
+    {
+        string arg = argv[a];
+        if (arg == "--ticks")
+            ticks = max(1L, atol(argv[++a]));
+        else if (arg == "--out")
+            outPath = argv[++a];
+        else if (arg == "--baseline")
+            baselinePath = argv[++a];
+        else if (arg == "--threshold")
+            threshold = atof(argv[++a]);
+        else if (arg == "--level" || arg == "--level-file" || arg == "--enemies" || arg == "--script")
+        {
+            string value = argv[++a];
+            if (arg == "--level")
+                custom.level = atoi(value.c_str());
+            else if (arg == "--level-file")
+                levelFile = value;
+            else if (arg == "--enemies")
+                custom.perType = max(0, atoi(value.c_str()));
+            else
+                custom.script = value;
+            useCustom = true;
+        }
+    }
+
+    if (load_level_set(levelDir, levelTable) == 0)
+    {
+        cerr << "No levels found in " << levelDir << endl;
+        return 2;
+    }
+
+    // A level file under test is played as one past the last stock level
+    if (!levelFile.empty())
+    {
+        LevelData ld;
+        if (!load_level(levelFile, ld))
+            return 2;
+        levelTable.push_back(ld);
+        custom.level = (int)levelTable.size();
+    }
+    if (custom.level < 1 || custom.level > (int)levelTable.size())
+    {
+        cerr << "no level " << custom.level << endl;
+        return 2;
+    }
+
+    vector<BenchScenario> scenarios;
+    if (useCustom)
+    {
+        scenarios.push_back(custom);
+    }
+    else
+    {
+        const struct
+        {
+            const char *name;
+            int level;
+            int perType;
+            const char *script;
+        } suite[] = {
+            {"level1_stock_patrol", 1, 0, "patrol"},
+            {"level1_stock_random", 1, 0, "random"},
+            {"level2_stock_vacuum", 2, 0, "vacuum"},
+            {"level1_horde100_patrol", 1, 100, "patrol"},
+            {"level2_horde100_vacuum", 2, 100, "vacuum"},
+            {"level2_horde1000_patrol", 2, 1000, "patrol"},
+        };
+        for (const auto &s : suite)
+        {
+            BenchScenario sc;
+            sc.name = s.name;
+            sc.level = s.level;
+            sc.perType = s.perType;
+            sc.script = s.script;
+            scenarios.push_back(sc);
+        }
+    }
+
+    map<string, map<string, double>> base;
+    if (!baselinePath.empty())
+        base = load_baseline(baselinePath);
+
+    ostringstream json;
+    json << "{\n\"scenarios\": [\n";
+    int regressions = 0;
+    for (size_t k = 0; k < scenarios.size(); k++)
+    {
+        const BenchScenario &sc = scenarios[k];
+        BenchResult r = run_scenario(sc, ticks, false);
+        BenchResult timed = run_scenario(sc, ticks, true);
+        copy(timed.phaseNsPerTick, timed.phaseNsPerTick + PROF_PHASES, r.phaseNsPerTick);
+        r.rewindNsPerTick = timed.rewindNsPerTick;
+        r.rewindKb = timed.rewindKb;
+        r.rewindArenaKb = timed.rewindArenaKb;
+        r.rewindSeconds = timed.rewindSeconds;
+        r.rewindEarlyDrops = timed.rewindEarlyDrops;
+
+        json << scenario_json(sc, r) << (k + 1 < scenarios.size() ? ",\n" : "\n");
+        cerr << sc.name << ": " << r.nsPerTick << " ns/tick" << endl;
+
+        if (!baselinePath.empty())
+            regressions += compare_baseline(base, sc, r, threshold);
+    }
+    json << "],\n\"process_peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+
+    if (outPath.empty())
+    {
+        cout << json.str();
+    }
+    else
+    {
+        ofstream out(outPath);
+        out << json.str();
+    }
+
+    if (regressions > 0)
+        cerr << regressions << " regression(s) over " << threshold * 100 << "%" << endl;
+    return regressions > 0 ? 1 : 0;
+}
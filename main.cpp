@@ -1,6 +1,23 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
 #include <SFML/Window.hpp>
@@ -11,19 +28,450 @@ using namespace std;
 int screen_x = 1136;
 int screen_y = 896;
 
-char getTile(char **lvl, int row, int col, int height, int width)
+// Zone tracing for offline analysis, compiled in with -DTUMBLEPOP_TRACE.
+// TRACE_ZONE("name") records how long the rest of the enclosing block takes on
+// the calling thread. Events go into a fixed ring that keeps the newest
+// TRACE_CAPACITY zones and are written as Chrome trace-event JSON (open in
+// chrome://tracing or ui.perfetto.dev) on exit or with F4. Without the define
+// the macro expands to nothing.
+#ifdef TUMBLEPOP_TRACE
+
+const int TRACE_CAPACITY = 1 << 16;
+
+// One ring slot. seq holds the event number + 1 once the slot is fully written
+// and 0 while a writer is filling it, so the exporter can skip torn slots.
+struct TraceEvent
+{
+    atomic<unsigned long long> seq{0};
+    atomic<const char *> name{nullptr};
+    atomic<unsigned> tid{0};
+    atomic<long long> startNs{0};
+    atomic<long long> durNs{0};
+};
+
+TraceEvent traceRing[TRACE_CAPACITY];
+atomic<unsigned long long> traceHead{0};
+atomic<unsigned> traceThreadCount{0};
+const chrono::steady_clock::time_point traceEpoch = chrono::steady_clock::now();
+
+unsigned trace_thread_id()
+{
+    thread_local unsigned id = traceThreadCount.fetch_add(1) + 1;
+    return id;
+}
+
+long long trace_now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - traceEpoch).count();
+}
+
+void trace_record(const char *name, long long startNs, long long endNs)
+{
+    unsigned long long n = traceHead.fetch_add(1, memory_order_relaxed);
+    TraceEvent &e = traceRing[n % TRACE_CAPACITY];
+
+    e.seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e.name.store(name, memory_order_relaxed);
+    e.tid.store(trace_thread_id(), memory_order_relaxed);
+    e.startNs.store(startNs, memory_order_relaxed);
+    e.durNs.store(endNs - startNs, memory_order_relaxed);
+    e.seq.store(n + 1, memory_order_release);
+}
+
+struct TraceZone
+{
+    const char *name;
+    long long startNs;
+
+    TraceZone(const char *n) : name(n), startNs(trace_now_ns()) {}
+    ~TraceZone() { trace_record(name, startNs, trace_now_ns()); }
+};
+
+// Writes the events currently in the ring, oldest first. Safe to call while
+// other threads keep recording.
+void trace_write(const string &path)
+{
+    ofstream out(path);
+    if (!out)
+    {
+        cout << "could not write " << path << endl;
+        return;
+    }
+
+    unsigned long long head = traceHead.load(memory_order_acquire);
+    unsigned long long first = head > (unsigned long long)TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+    int written = 0;
+
+    out << "{\"traceEvents\":[\n";
+    for (unsigned long long n = first; n < head; n++)
+    {
+        TraceEvent &e = traceRing[n % TRACE_CAPACITY];
+        unsigned long long seq = e.seq.load(memory_order_acquire);
+        const char *name = e.name.load(memory_order_relaxed);
+        unsigned tid = e.tid.load(memory_order_relaxed);
+        long long startNs = e.startNs.load(memory_order_relaxed);
+        long long durNs = e.durNs.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != n + 1 || e.seq.load(memory_order_relaxed) != seq)
+            continue;
+
+        if (written > 0)
+            out << ",\n";
+        out << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << startNs / 1000.0 << ",\"dur\":" << durNs / 1000.0 << "}";
+        written++;
+    }
+    out << "\n]}\n";
+
+    cout << "wrote " << written << " trace events to " << path << endl;
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+#else
+
+#define TRACE_ZONE(name)
+
+#endif
+
+// Frame profiler: scoped timers per phase, draw-call and texture-switch counters
+// and a rolling window of frame times. F3 toggles the overlay that shows them.
+const int PROF_INPUT = 0;
+const int PROF_SIM = 1; // all of stepGame, the next seven phases are part of it
+const int PROF_PLAYER = 2;
+const int PROF_ENEMIES = 3;
+const int PROF_STUCK = 4;
+const int PROF_GENOVA = 5;
+const int PROF_VACUUM = 6;
+const int PROF_THROWN = 7;
+const int PROF_PROJECTILES = 8;
+const int PROF_REWIND = 9; // recording into the rewind buffer, or stepping back
+const int PROF_LEVEL_LOAD = 10;
+const int PROF_DRAW_MENU = 11;
+const int PROF_DRAW_LEVEL = 12;
+const int PROF_DRAW_SPRITES = 13;
+const int PROF_DRAW_HUD = 14;
+const int PROF_DISPLAY = 15;
+const int PROF_PHASES = 16;
+
+const char *profPhaseNames[PROF_PHASES] = {
+    "input", "simulation", "  player", "  enemy update", "  stuck pass", "  genova attack",
+    "  vacuum", "  thrown enemies", "  projectiles", "rewind", "level load", "draw menu", "draw level", "draw sprites",
+    "draw hud", "display"};
+
+const int PROF_HISTORY = 240; // frames kept for the percentiles and the graph
+
+struct FrameProfiler
+{
+    bool enabled = false; // phase timers only run while this is set
+    bool overlay = false;
+
+    // This frame so far. The simulation thread adds its phases concurrently,
+    // hence atomic nanoseconds.
+    atomic<long long> phaseNs[PROF_PHASES] = {};
+    double shownMs[PROF_PHASES] = {}; // smoothed over recent frames, printed by the overlay
+
+    int drawCalls = 0;
+    int textureSwitches = 0;
+    const Texture *boundTexture = nullptr;
+    int lastDrawCalls = 0;
+    int lastTextureSwitches = 0;
+
+    float frameMs[PROF_HISTORY] = {};
+    int frameHead = 0;
+    int frameCount = 0;
+    chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+};
+
+FrameProfiler profiler;
+
+// Adds the time until the end of the enclosing block to one phase
+struct ProfScope
+{
+    int phase;
+    bool on;
+    chrono::steady_clock::time_point start;
+
+    ProfScope(int p) : phase(p), on(profiler.enabled)
+    {
+        if (on)
+            start = chrono::steady_clock::now();
+    }
+
+    ~ProfScope()
+    {
+        if (on)
+            profiler.phaseNs[phase].fetch_add(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(),
+                memory_order_relaxed);
+    }
+};
+
+void prof_count_draw(const Texture *tex)
+{
+    profiler.drawCalls++;
+    if (tex != profiler.boundTexture)
+    {
+        profiler.textureSwitches++;
+        profiler.boundTexture = tex;
+    }
+}
+
+// window.draw plus the draw-call / texture-switch bookkeeping
+void prof_draw(RenderTarget &window, const Sprite &spr)
+{
+    prof_count_draw(spr.getTexture());
+    window.draw(spr);
+}
+
+void prof_draw(RenderTarget &window, const Shape &shape)
+{
+    prof_count_draw(shape.getTexture());
+    window.draw(shape);
+}
+
+void prof_draw(RenderTarget &window, const Text &text)
+{
+    prof_count_draw(text.getFont() ? &text.getFont()->getTexture(text.getCharacterSize()) : nullptr);
+    window.draw(text);
+}
+
+void prof_draw(RenderTarget &window, const VertexArray &va, const RenderStates &states)
+{
+    prof_count_draw(states.texture);
+    window.draw(va, states);
+}
+
+// Call once per frame after display
+void prof_end_frame()
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    profiler.frameMs[profiler.frameHead] = chrono::duration<float, milli>(now - profiler.frameStart).count();
+    profiler.frameStart = now;
+    profiler.frameHead = (profiler.frameHead + 1) % PROF_HISTORY;
+    profiler.frameCount = min(profiler.frameCount + 1, PROF_HISTORY);
+
+    for (int p = 0; p < PROF_PHASES; p++)
+    {
+        double ms = profiler.phaseNs[p].exchange(0, memory_order_relaxed) / 1e6;
+        profiler.shownMs[p] = 0.9 * profiler.shownMs[p] + 0.1 * ms;
+    }
+
+    profiler.lastDrawCalls = profiler.drawCalls;
+    profiler.lastTextureSwitches = profiler.textureSwitches;
+    profiler.drawCalls = 0;
+    profiler.textureSwitches = 0;
+    profiler.boundTexture = nullptr;
+}
+
+// Frame time (ms) below which pct percent of the recorded frames fall
+float prof_percentile(float pct)
+{
+    if (profiler.frameCount == 0)
+        return 0;
+    float sorted[PROF_HISTORY];
+    copy(profiler.frameMs, profiler.frameMs + profiler.frameCount, sorted);
+    int k = min(profiler.frameCount - 1, (int)(pct / 100.0f * profiler.frameCount));
+    nth_element(sorted, sorted + k, sorted + profiler.frameCount);
+    return sorted[k];
+}
+
+// Phase table, counters, percentiles and a bar graph of the last PROF_HISTORY
+// frames (the line marks 16.6 ms). Drawn with window.draw so it doesn't count itself.
+void draw_profiler_overlay(RenderWindow &window, const Font &font, bool fontLoaded)
+{
+    const float left = screen_x - 330;
+    const float top = 10;
+
+    RectangleShape panel(Vector2f(320, 440));
+    panel.setPosition(left, top);
+    panel.setFillColor(Color(0, 0, 0, 180));
+    window.draw(panel);
+
+    if (fontLoaded)
+    {
+        string lines;
+        char buf[96];
+        for (int p = 0; p < PROF_PHASES; p++)
+        {
+            snprintf(buf, sizeof(buf), "%-18s %7.3f ms\n", profPhaseNames[p], profiler.shownMs[p]);
+            lines += buf;
+        }
+        snprintf(buf, sizeof(buf), "\ndraw calls %d   texture switches %d\n", profiler.lastDrawCalls, profiler.lastTextureSwitches);
+        lines += buf;
+        snprintf(buf, sizeof(buf), "frame p50 %.2f  p95 %.2f  p99 %.2f ms", prof_percentile(50), prof_percentile(95), prof_percentile(99));
+        lines += buf;
+
+        Text text;
+        text.setFont(font);
+        text.setCharacterSize(14);
+        text.setFillColor(Color::White);
+        text.setString(lines);
+        text.setPosition(left + 8, top + 6);
+        window.draw(text);
+    }
+
+    // one bar per frame, oldest on the left, 4 px per ms
+    const float graphBottom = top + 430;
+    VertexArray bars(Lines);
+    for (int f = 0; f < profiler.frameCount; f++)
+    {
+        int idx = (profiler.frameHead - profiler.frameCount + f + PROF_HISTORY) % PROF_HISTORY;
+        float h = min(profiler.frameMs[idx] * 4.0f, 100.0f);
+        Color c = profiler.frameMs[idx] > 17.0f ? Color::Red : Color::Green;
+        bars.append(Vertex(Vector2f(left + 40 + f, graphBottom), c));
+        bars.append(Vertex(Vector2f(left + 40 + f, graphBottom - h), c));
+    }
+    bars.append(Vertex(Vector2f(left + 40, graphBottom - 16.6f * 4.0f), Color::Yellow));
+    bars.append(Vertex(Vector2f(left + 40 + PROF_HISTORY, graphBottom - 16.6f * 4.0f), Color::Yellow));
+    window.draw(bars);
+}
+
+// Per-tile collision flags, looked up from the tile char once when the tile is set
+const unsigned char TILE_SOLID = 1;      // blocks from every side: '#', '/', '\\'
+const unsigned char TILE_ONE_WAY = 2;    // can be stood on and dropped through: '-'
+const unsigned char TILE_SLOPE_UP = 4;   // '/'
+const unsigned char TILE_SLOPE_DOWN = 8; // '\\'
+const unsigned char TILE_GROUND = TILE_SOLID | TILE_ONE_WAY; // anything you can stand on
+
+// The level as one row-major buffer of tile chars plus a parallel flag byte per tile.
+// Next to it each row is kept as bitboards (bit c of the row = column c) so range
+// queries become a few shift-and-mask operations. A row spans rowWords 64-bit words.
+struct TileMap
+{
+    int height = 0;
+    int width = 0;
+    vector<char> tiles;
+    vector<unsigned char> flags;
+
+    int rowWords = 0;
+    vector<unsigned long long> solidBits;  // TILE_SOLID
+    vector<unsigned long long> groundBits; // TILE_GROUND, every non-empty tile
+
+    // Spawn index, see build_spawn_index: per cell the nearest cell an air
+    // type (0, 2) or a ground type (1, 3) may stand in, packed as
+    // row << 16 | col, -1 if there is none
+    vector<int> nearestAir;
+    vector<int> nearestGround;
+};
+
+unsigned char tileFlagTable[256];
+
+void init_tile_flag_table()
+{
+    for (int i = 0; i < 256; i++)
+        tileFlagTable[i] = 0;
+    tileFlagTable[(unsigned char)'#'] = TILE_SOLID;
+    tileFlagTable[(unsigned char)'-'] = TILE_ONE_WAY;
+    tileFlagTable[(unsigned char)'/'] = TILE_SOLID | TILE_SLOPE_UP;
+    tileFlagTable[(unsigned char)'\\'] = TILE_SOLID | TILE_SLOPE_DOWN;
+}
+
+void init_tile_map(TileMap &lvl, int height, int width)
+{
+    lvl.height = height;
+    lvl.width = width;
+    lvl.tiles.assign(height * width, ' ');
+    lvl.flags.assign(height * width, 0);
+    lvl.rowWords = (width + 63) / 64;
+    lvl.solidBits.assign(height * lvl.rowWords, 0);
+    lvl.groundBits.assign(height * lvl.rowWords, 0);
+    lvl.nearestAir.clear();
+    lvl.nearestGround.clear();
+}
+
+void clear_tile_map(TileMap &lvl)
+{
+    fill(lvl.tiles.begin(), lvl.tiles.end(), ' ');
+    fill(lvl.flags.begin(), lvl.flags.end(), 0);
+    fill(lvl.solidBits.begin(), lvl.solidBits.end(), 0);
+    fill(lvl.groundBits.begin(), lvl.groundBits.end(), 0);
+    lvl.nearestAir.clear();
+    lvl.nearestGround.clear();
+}
+
+void set_tile(TileMap &lvl, int row, int col, char t)
+{
+    unsigned char f = tileFlagTable[(unsigned char)t];
+    lvl.tiles[row * lvl.width + col] = t;
+    lvl.flags[row * lvl.width + col] = f;
+
+    int word = row * lvl.rowWords + col / 64;
+    unsigned long long bit = 1ULL << (col % 64);
+    if (f & TILE_SOLID)
+        lvl.solidBits[word] |= bit;
+    else
+        lvl.solidBits[word] &= ~bit;
+    if (f & TILE_GROUND)
+        lvl.groundBits[word] |= bit;
+    else
+        lvl.groundBits[word] &= ~bit;
+}
+
+char getTile(const TileMap &lvl, int row, int col)
 {
-    if (row < 0 || row >= height || col < 0 || col >= width)
+    if (row < 0 || row >= lvl.height || col < 0 || col >= lvl.width)
         return ' ';
-    return lvl[row][col];
+    return lvl.tiles[row * lvl.width + col];
+}
+
+// Flags of a tile, outside the map counts as empty
+unsigned char tileFlags(const TileMap &lvl, int row, int col)
+{
+    if (row < 0 || row >= lvl.height || col < 0 || col >= lvl.width)
+        return 0;
+    return lvl.flags[row * lvl.width + col];
+}
+
+// One cell of a bitboard, outside the map counts as empty
+bool tile_bit(const TileMap &lvl, const vector<unsigned long long> &bits, int row, int col)
+{
+    if (row < 0 || row >= lvl.height || col < 0 || col >= lvl.width)
+        return false;
+    return (bits[row * lvl.rowWords + col / 64] >> (col % 64)) & 1ULL;
+}
+
+// Whether any bit in columns colFrom..colTo of a row is set. Columns outside
+// the map are ignored.
+bool row_range_any(const TileMap &lvl, const vector<unsigned long long> &bits, int row, int colFrom, int colTo)
+{
+    if (row < 0 || row >= lvl.height)
+        return false;
+    colFrom = max(colFrom, 0);
+    colTo = min(colTo, lvl.width - 1);
+    if (colFrom > colTo)
+        return false;
+
+    const unsigned long long *words = &bits[row * lvl.rowWords];
+    int first = colFrom / 64;
+    int last = colTo / 64;
+    for (int k = first; k <= last; k++)
+    {
+        unsigned long long mask = ~0ULL;
+        if (k == first)
+            mask &= ~0ULL << (colFrom % 64);
+        if (k == last)
+            mask &= ~0ULL >> (63 - colTo % 64);
+        if (words[k] & mask)
+            return true;
+    }
+    return false;
 }
 
-bool isSolidTile(char t)
+// Empty cell an enemy of this type may stand in: ground types (1, 3) also need ground beneath
+bool spawn_cell_ok(const TileMap &lvl, int row, int col, int type)
 {
-    return (t == '#' || t == '-' || t == '/' || t == '\\');
+    if (tile_bit(lvl, lvl.groundBits, row, col))
+        return false;
+    if (type == 1 || type == 3)
+        return tile_bit(lvl, lvl.groundBits, row + 1, col);
+    return true;
 }
 
-bool overlapsSolid(char **lvl, float x, float y, int w, int h, int cell_size)
+bool overlapsSolid(const TileMap &lvl, float x, float y, int w, int h, int cell_size)
 {
     int left = (int)(x) / cell_size;
     int right = (int)(x + w - 1) / cell_size;
@@ -32,36 +480,239 @@ bool overlapsSolid(char **lvl, float x, float y, int w, int h, int cell_size)
 
     for (int r = top; r <= bottom; ++r)
     {
-        for (int c = left; c <= right; ++c)
+        if (row_range_any(lvl, lvl.groundBits, r, left, right))
+            return true;
+    }
+    return false;
+}
+
+// First column in colFrom..colTo of a row whose bit is set, -1 if none
+int row_range_first(const TileMap &lvl, const vector<unsigned long long> &bits, int row, int colFrom, int colTo)
+{
+    if (!row_range_any(lvl, bits, row, colFrom, colTo))
+        return -1;
+    for (int c = max(colFrom, 0); c <= colTo; c++)
+        if (tile_bit(lvl, bits, row, c))
+            return c;
+    return -1;
+}
+
+// First row in rowFrom..rowTo of a column whose bit is set, -1 if none
+int col_range_first(const TileMap &lvl, const vector<unsigned long long> &bits, int col, int rowFrom, int rowTo)
+{
+    for (int r = max(rowFrom, 0); r <= rowTo && r < lvl.height; r++)
+        if (tile_bit(lvl, bits, r, col))
+            return r;
+    return -1;
+}
+
+// Result of sweeping a box through the tiles
+struct SweepHit
+{
+    bool hit = false;
+    float time = 1.0f; // fraction of the move done at contact, 0..1
+    int normalX = 0;   // normal of the face that was hit, against the move
+    int normalY = 0;
+    int row = -1;      // the tile that was hit
+    int col = -1;
+};
+
+// Sweeps the w x h box at (x, y) along (dx, dy) against the tiles set in bits
+// and returns the first contact. The leading edges are walked cell by cell in
+// the order they cross grid lines (a DDA), checking the row or column of tiles
+// they enter at that moment, so a move longer than a tile cannot tunnel.
+// Moving right or down the leading edge is the pixel just past the box, moving
+// left or up the box's own first pixel, like the point probes it replaces.
+// The tile already under a leading edge only counts (as a hit at time 0) when
+// the edge doesn't leave it this move; the probes also only looked where the
+// edge ends up, and a box hugging a wall has the wall under its edge.
+SweepHit sweep_box(const TileMap &lvl, const vector<unsigned long long> &bits,
+                   float x, float y, float w, float h, float dx, float dy, int cell_size)
+{
+    SweepHit result;
+    int stepX = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+    int stepY = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+    float leadX = dx > 0 ? x + w : x;
+    float leadY = dy > 0 ? y + h : y;
+    int col = (int)floor(leadX / cell_size);
+    int row = (int)floor(leadY / cell_size);
+    int endCol = (int)floor((leadX + dx) / cell_size);
+    int endRow = (int)floor((leadY + dy) / cell_size);
+
+    // Tiles already under leading edges that stay in their cell
+    if (stepX != 0 && col == endCol)
+    {
+        int r = col_range_first(lvl, bits, col, (int)floor(y / cell_size), (int)floor((y + h - 1) / cell_size));
+        if (r >= 0)
         {
-            if (getTile(lvl, r, c, h, w) != ' ' && isSolidTile(getTile(lvl, r, c, h, w)))
-                return true;
+            result.hit = true;
+            result.time = 0;
+            result.normalX = -stepX;
+            result.row = r;
+            result.col = col;
+            return result;
         }
     }
-    return false;
+    if (stepY != 0 && row == endRow)
+    {
+        int c = row_range_first(lvl, bits, row, (int)floor(x / cell_size), (int)floor((x + w - 1) / cell_size));
+        if (c >= 0)
+        {
+            result.hit = true;
+            result.time = 0;
+            result.normalY = -stepY;
+            result.row = row;
+            result.col = c;
+            return result;
+        }
+    }
+
+    // Time at which the leading edge enters the next column / row
+    float nextTX = 2.0f, nextTY = 2.0f;
+    float deltaTX = 0, deltaTY = 0;
+    if (stepX != 0)
+    {
+        nextTX = ((stepX > 0 ? col + 1 : col) * cell_size - leadX) / dx;
+        deltaTX = cell_size / fabs(dx);
+    }
+    if (stepY != 0)
+    {
+        nextTY = ((stepY > 0 ? row + 1 : row) * cell_size - leadY) / dy;
+        deltaTY = cell_size / fabs(dy);
+    }
+
+    while (col != endCol || row != endRow)
+    {
+        if (row == endRow || (col != endCol && nextTX <= nextTY))
+        {
+            float t = min(max(nextTX, 0.0f), 1.0f);
+            col += stepX;
+            nextTX += deltaTX;
+
+            float boxY = y + dy * t;
+            int r = col_range_first(lvl, bits, col, (int)floor(boxY / cell_size),
+                                    (int)floor((boxY + h - 1) / cell_size));
+            if (r >= 0)
+            {
+                result.hit = true;
+                result.time = t;
+                result.normalX = -stepX;
+                result.row = r;
+                result.col = col;
+                return result;
+            }
+        }
+        else
+        {
+            float t = min(max(nextTY, 0.0f), 1.0f);
+            row += stepY;
+            nextTY += deltaTY;
+
+            float boxX = x + dx * t;
+            int c = row_range_first(lvl, bits, row, (int)floor(boxX / cell_size),
+                                    (int)floor((boxX + w - 1) / cell_size));
+            if (c >= 0)
+            {
+                result.hit = true;
+                result.time = t;
+                result.normalY = -stepY;
+                result.row = row;
+                result.col = c;
+                return result;
+            }
+        }
+    }
+    return result;
 }
 
-void findValidSpawn(char **lvl, int &spawnRow, int &spawnCol, int type, int height, int width)
+// Whether candidate cell a beats cell b as the spawn for (row, col): nearer by
+// Manhattan distance, then lower column, then lower row. That is the order the
+// expanding-diamond search visits cells in, so both pick the same cell.
+bool spawn_candidate_better(int a, int b, int row, int col)
 {
-    // If current cell is already valid, keep it
-    if (spawnRow >= 0 && spawnRow < height && spawnCol >= 0 && spawnCol < width)
+    if (b < 0)
+        return true;
+    int ar = a >> 16, ac = a & 0xFFFF;
+    int br = b >> 16, bc = b & 0xFFFF;
+    int da = abs(ar - row) + abs(ac - col);
+    int db = abs(br - row) + abs(bc - col);
+    if (da != db)
+        return da < db;
+    if (ac != bc)
+        return ac < bc;
+    return ar < br;
+}
+
+// Manhattan distance transform carrying the nearest valid cell: a forward pass
+// pulls candidates from above and the left, a backward pass from below and the
+// right. Tiles only change in startLevel, which rebuilds this afterwards.
+void build_spawn_index(TileMap &lvl)
+{
+    TRACE_ZONE("build_spawn_index");
+    const int height = lvl.height;
+    const int width = lvl.width;
+    for (int ground = 0; ground < 2; ground++)
     {
-        char cur = getTile(lvl, spawnRow, spawnCol, height, width);
-        if (cur == ' ')
+        vector<int> &nearest = ground ? lvl.nearestGround : lvl.nearestAir;
+        nearest.assign(height * width, -1);
+        for (int r = 0; r < height; r++)
         {
-            if (type == 1 || type == 3)
+            for (int c = 0; c < width; c++)
             {
-                // ground enemy: require solid beneath
-                if (isSolidTile(getTile(lvl, spawnRow + 1, spawnCol, height, width)))
-                    return;
+                if (spawn_cell_ok(lvl, r, c, ground ? 1 : 0))
+                    nearest[r * width + c] = r << 16 | c;
             }
-            else
+        }
+
+        for (int r = 0; r < height; r++)
+        {
+            for (int c = 0; c < width; c++)
             {
-                // flying/invisible: empty cell ok
-                return;
+                int &best = nearest[r * width + c];
+                if (r > 0 && nearest[(r - 1) * width + c] >= 0 && spawn_candidate_better(nearest[(r - 1) * width + c], best, r, c))
+                    best = nearest[(r - 1) * width + c];
+                if (c > 0 && nearest[r * width + c - 1] >= 0 && spawn_candidate_better(nearest[r * width + c - 1], best, r, c))
+                    best = nearest[r * width + c - 1];
+            }
+        }
+        for (int r = height - 1; r >= 0; r--)
+        {
+            for (int c = width - 1; c >= 0; c--)
+            {
+                int &best = nearest[r * width + c];
+                if (r + 1 < height && nearest[(r + 1) * width + c] >= 0 && spawn_candidate_better(nearest[(r + 1) * width + c], best, r, c))
+                    best = nearest[(r + 1) * width + c];
+                if (c + 1 < width && nearest[r * width + c + 1] >= 0 && spawn_candidate_better(nearest[r * width + c + 1], best, r, c))
+                    best = nearest[r * width + c + 1];
             }
         }
     }
+}
+
+// Nearest cell an enemy of this type may stand in, in place. Cells on the map
+// are a lookup in the spawn index; positions off the map fall back to the
+// expanding-radius search.
+void findValidSpawn(const TileMap &lvl, int &spawnRow, int &spawnCol, int type)
+{
+    const int height = lvl.height;
+    const int width = lvl.width;
+
+    if (spawnRow >= 0 && spawnRow < height && spawnCol >= 0 && spawnCol < width && !lvl.nearestAir.empty())
+    {
+        const vector<int> &nearest = (type == 1 || type == 3) ? lvl.nearestGround : lvl.nearestAir;
+        int cell = nearest[spawnRow * width + spawnCol];
+        if (cell >= 0)
+        {
+            spawnRow = cell >> 16;
+            spawnCol = cell & 0xFFFF;
+        }
+        return;
+    }
+
+    // If current cell is already valid, keep it
+    if (spawnRow >= 0 && spawnRow < height && spawnCol >= 0 && spawnCol < width &&
+        spawn_cell_ok(lvl, spawnRow, spawnCol, type))
+        return;
 
     // Search in expanding radius for a valid cell
     int maxRadius = max(height, width);
@@ -76,19 +727,7 @@ void findValidSpawn(char **lvl, int &spawnRow, int &spawnCol, int type, int heig
                 int nc = spawnCol + dc;
                 if (nr < 0 || nr >= height || nc < 0 || nc >= width)
                     continue;
-                char cur = getTile(lvl, nr, nc, height, width);
-                if (cur != ' ')
-                    continue;
-                if (type == 1 || type == 3)
-                {
-                    if (isSolidTile(getTile(lvl, nr + 1, nc, height, width)))
-                    {
-                        spawnRow = nr;
-                        spawnCol = nc;
-                        return;
-                    }
-                }
-                else
+                if (spawn_cell_ok(lvl, nr, nc, type))
                 {
                     spawnRow = nr;
                     spawnCol = nc;
@@ -103,41 +742,288 @@ void findValidSpawn(char **lvl, int &spawnRow, int &spawnCol, int type, int heig
     spawnCol = max(0, min(spawnCol, width - 1));
 }
 
-void display_level(RenderWindow &window, char **lvl, Texture &bgTex, Sprite &bgSprite, Texture &blockTexture, Sprite &blockSprite, Sprite &oneWaySprite, Sprite &slopeSprite, Sprite &slopeBotSprite, const int height, const int width, const int cell_size, int selectedLevel)
+// Tile kinds drawn by the tile layer, one vertex array (and one draw call) each
+const int TILE_BLOCK = 0;    // '#'
+const int TILE_ONEWAY = 1;   // '-'
+const int TILE_SLOPE = 2;    // '/'
+const int TILE_SLOPE_BOT = 3; // '\\'
+const int TILE_KINDS = 4;
+
+// Where one packed image ended up inside the atlas
+struct AtlasFrame
+{
+    int page = 0;
+    IntRect rect;
+};
+
+// A few large textures holding many small images, so sprites switching
+// frames only change their texture rect and not the bound texture
+struct TextureAtlas
 {
-    window.draw(bgSprite);
+    vector<Texture> pages;
+    map<string, AtlasFrame> frames; // keyed by file path
+};
+
+// Shelf-packs already decoded images into pageSize x pageSize pages, tallest first.
+// ok[i] is false for files that failed to decode, those are left out.
+void build_atlas(TextureAtlas &atlas, const vector<string> &files, const vector<Image> &images, const vector<char> &ok, unsigned pageSize)
+{
+    const int padding = 1; // keeps neighbours from bleeding into each other
+
+    vector<int> order;
+    for (int i = 0; i < (int)files.size(); i++)
+    {
+        if (!ok[i])
+            continue;
+        else if (images[i].getSize().x > pageSize || images[i].getSize().y > pageSize)
+            cout << files[i] << " is too big for an atlas page" << endl;
+        else
+            order.push_back(i);
+    }
+
+    sort(order.begin(), order.end(), [&images](int a, int b)
+         { return images[a].getSize().y > images[b].getSize().y; });
+
+    vector<Image> pageImages;
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
 
-    for (int i = 0; i < height; i += 1)
+    for (int idx : order)
     {
-        for (int j = 0; j < width; j += 1)
+        int w = images[idx].getSize().x;
+        int h = images[idx].getSize().y;
+
+        // start a new shelf when this row is full
+        if (!pageImages.empty() && x + w > (int)pageSize)
         {
-            if (lvl[i][j] == '#')
-            {
-                blockSprite.setPosition(j * cell_size, i * cell_size);
-                window.draw(blockSprite);
-            }
-            else if (lvl[i][j] == '-')
-            {
-                oneWaySprite.setPosition(j * cell_size, i * cell_size);
-                window.draw(oneWaySprite);
-            }
-            else if (lvl[i][j] == '/')
-            {
-                slopeSprite.setPosition(j * cell_size, i * cell_size);
-                window.draw(slopeSprite);
-            }
-            else if (lvl[i][j] == '\\')
+            x = 0;
+            y += shelfHeight + padding;
+            shelfHeight = 0;
+        }
+
+        // start a new page when the shelves are full
+        if (pageImages.empty() || y + h > (int)pageSize)
+        {
+            pageImages.push_back(Image());
+            pageImages.back().create(pageSize, pageSize, Color::Transparent);
+            x = 0;
+            y = 0;
+            shelfHeight = 0;
+        }
+
+        pageImages.back().copy(images[idx], x, y);
+
+        AtlasFrame frame;
+        frame.page = (int)pageImages.size() - 1;
+        frame.rect = IntRect(x, y, w, h);
+        atlas.frames[files[idx]] = frame;
+
+        x += w + padding;
+        shelfHeight = max(shelfHeight, h);
+    }
+
+    atlas.pages.resize(pageImages.size());
+    for (int p = 0; p < (int)pageImages.size(); p++)
+        atlas.pages[p].loadFromImage(pageImages[p]);
+}
+
+AtlasFrame atlas_frame(const TextureAtlas &atlas, const string &file)
+{
+    map<string, AtlasFrame>::const_iterator it = atlas.frames.find(file);
+    if (it == atlas.frames.end())
+    {
+        cout << file << " is not in the atlas" << endl;
+        return AtlasFrame();
+    }
+    return it->second;
+}
+
+void set_atlas_frame(Sprite &spr, const TextureAtlas &atlas, const AtlasFrame &frame)
+{
+    if (atlas.pages.empty())
+        return;
+    spr.setTexture(atlas.pages[frame.page]);
+    spr.setTextureRect(frame.rect);
+}
+
+// Levels are cut into square chunks of CHUNK_TILES x CHUNK_TILES tiles. Tile
+// geometry is built per chunk so drawing skips everything outside the view, and
+// the simulation slows down enemies outside the chunks around the player.
+// A chunk is larger than half the screen, so the view never reaches past the
+// chunks next to the player's.
+const int CHUNK_TILES = 16;
+
+// Tile geometry of a level, TILE_KINDS vertex arrays per chunk
+struct TileChunks
+{
+    int cols = 0;
+    int rows = 0;
+    vector<VertexArray> layers; // index (row * cols + col) * TILE_KINDS + kind
+};
+
+// Turns the level grid into textured triangles grouped by chunk and tile kind.
+// Only needs to run when the level changes.
+void build_tile_chunks(TileChunks &chunks, const TileMap &lvl, const AtlasFrame tileFrames[], const int cell_size)
+{
+    chunks.cols = (lvl.width + CHUNK_TILES - 1) / CHUNK_TILES;
+    chunks.rows = (lvl.height + CHUNK_TILES - 1) / CHUNK_TILES;
+    chunks.layers.assign(chunks.cols * chunks.rows * TILE_KINDS, VertexArray(Triangles));
+
+    for (int i = 0; i < lvl.height; i += 1)
+    {
+        for (int j = 0; j < lvl.width; j += 1)
+        {
+            char t = getTile(lvl, i, j);
+            int kind;
+            if (t == '#')
+                kind = TILE_BLOCK;
+            else if (t == '-')
+                kind = TILE_ONEWAY;
+            else if (t == '/')
+                kind = TILE_SLOPE;
+            else if (t == '\\')
+                kind = TILE_SLOPE_BOT;
+            else
+                continue;
+
+            // Same footprint a sprite would have: unscaled image at the cell's corner
+            const IntRect &r = tileFrames[kind].rect;
+            float tw = r.width;
+            float th = r.height;
+            float u = r.left;
+            float v = r.top;
+            float x = j * cell_size;
+            float y = i * cell_size;
+
+            int chunk = (i / CHUNK_TILES) * chunks.cols + j / CHUNK_TILES;
+            VertexArray &layer = chunks.layers[chunk * TILE_KINDS + kind];
+            layer.append(Vertex(Vector2f(x, y), Vector2f(u, v)));
+            layer.append(Vertex(Vector2f(x + tw, y), Vector2f(u + tw, v)));
+            layer.append(Vertex(Vector2f(x + tw, y + th), Vector2f(u + tw, v + th)));
+            layer.append(Vertex(Vector2f(x, y), Vector2f(u, v)));
+            layer.append(Vertex(Vector2f(x + tw, y + th), Vector2f(u + tw, v + th)));
+            layer.append(Vertex(Vector2f(x, y + th), Vector2f(u, v + th)));
+        }
+    }
+}
+
+// Draws the chunks overlapping area (a world rect) into target
+void draw_tile_chunks(RenderTarget &target, const TileChunks &chunks, const TextureAtlas &atlas,
+                      const AtlasFrame tileFrames[], const FloatRect &area, const int cell_size)
+{
+    // Tiles may be drawn up to a cell past their chunk, hence the extra cell on the left/top
+    const float chunkPx = CHUNK_TILES * cell_size;
+    float left = area.left - cell_size;
+    float top = area.top - cell_size;
+    int c0 = max(0, (int)floor(left / chunkPx));
+    int r0 = max(0, (int)floor(top / chunkPx));
+    int c1 = min(chunks.cols - 1, (int)floor((left + area.width + cell_size) / chunkPx));
+    int r1 = min(chunks.rows - 1, (int)floor((top + area.height + cell_size) / chunkPx));
+
+    for (int r = r0; r <= r1; r++)
+    {
+        for (int c = c0; c <= c1; c++)
+        {
+            for (int k = 0; k < TILE_KINDS; k++)
             {
-                slopeBotSprite.setPosition(j * cell_size, i * cell_size);
-                window.draw(slopeBotSprite);
+                const VertexArray &layer = chunks.layers[(r * chunks.cols + c) * TILE_KINDS + k];
+                if (layer.getVertexCount() > 0)
+                    prof_draw(target, layer, RenderStates(&atlas.pages[tileFrames[k].page]));
             }
         }
     }
 }
 
-bool enemy_horizontal_collision(char **lvl, float enemyX, float enemyY,
+// Cells of tiles kept around the view in the level cache of a scrolling level,
+// the cache is redrawn each time the camera moves this far
+const int LEVEL_CACHE_MARGIN = 4;
+
+// Background and tiles don't change during a level, so they are drawn once
+// into a texture and a frame only blits it. When the whole level fits the
+// screen the camera never moves: background and tiles are baked together and
+// the frame is a single quad. On a scrolling level the background stays fixed
+// to the screen, so it keeps its own sprite and the texture holds the tiles
+// around the view.
+struct LevelCache
+{
+    RenderTexture texture;
+    Vector2u textureSize;
+    Sprite quad;
+    bool valid = false;
+    bool fixedCamera = false;
+    FloatRect area; // world rect the texture holds
+};
+
+// Call when the level changes, the next display_level redraws the cache
+void level_cache_reset(LevelCache &cache, const TileMap &lvl, const int cell_size, float viewW, float viewH)
+{
+    cache.valid = false;
+    cache.fixedCamera = lvl.width * cell_size <= viewW && lvl.height * cell_size <= viewH;
+}
+
+void level_cache_render(LevelCache &cache, Sprite &bgSprite, const TileChunks &chunks, const TextureAtlas &atlas,
+                        const AtlasFrame tileFrames[], const View &camera, const int cell_size)
+{
+    TRACE_ZONE("level_cache_render");
+    float margin = cache.fixedCamera ? 0 : LEVEL_CACHE_MARGIN * cell_size;
+    float viewLeft = camera.getCenter().x - camera.getSize().x / 2;
+    float viewTop = camera.getCenter().y - camera.getSize().y / 2;
+    cache.area = FloatRect(floor(viewLeft - margin), floor(viewTop - margin),
+                           ceil(camera.getSize().x) + 2 * margin, ceil(camera.getSize().y) + 2 * margin);
+
+    Vector2u size((unsigned)cache.area.width, (unsigned)cache.area.height);
+    if (size.x != cache.textureSize.x || size.y != cache.textureSize.y)
+    {
+        if (!cache.texture.create(size.x, size.y))
+            cout << "Could not create the level cache texture" << endl;
+        cache.textureSize = size;
+    }
+
+    if (cache.fixedCamera)
+    {
+        cache.texture.clear(Color::Black);
+        cache.texture.setView(cache.texture.getDefaultView());
+        prof_draw(cache.texture, bgSprite);
+    }
+    else
+    {
+        cache.texture.clear(Color::Transparent);
+    }
+    cache.texture.setView(View(cache.area));
+    draw_tile_chunks(cache.texture, chunks, atlas, tileFrames, cache.area, cell_size);
+    cache.texture.display();
+
+    cache.quad.setTexture(cache.texture.getTexture(), true);
+    cache.quad.setPosition(cache.area.left, cache.area.top);
+    cache.valid = true;
+}
+
+// Draws the background and the tiles in view from the level cache, redrawing
+// the cache first if the level changed or the camera left the cached area
+void display_level(RenderWindow &window, LevelCache &cache, Sprite &bgSprite, const TileChunks &chunks,
+                   const TextureAtlas &atlas, const AtlasFrame tileFrames[], const View &camera, const int cell_size)
+{
+    float viewLeft = camera.getCenter().x - camera.getSize().x / 2;
+    float viewTop = camera.getCenter().y - camera.getSize().y / 2;
+    bool inside = viewLeft >= cache.area.left && viewTop >= cache.area.top &&
+                  viewLeft + camera.getSize().x <= cache.area.left + cache.area.width &&
+                  viewTop + camera.getSize().y <= cache.area.top + cache.area.height;
+    if (!cache.valid || !inside)
+        level_cache_render(cache, bgSprite, chunks, atlas, tileFrames, camera, cell_size);
+
+    if (!cache.fixedCamera)
+    {
+        window.setView(window.getDefaultView());
+        prof_draw(window, bgSprite);
+    }
+    window.setView(camera);
+    prof_draw(window, cache.quad);
+}
+
+bool enemy_horizontal_collision(const TileMap &lvl, float enemyX, float enemyY,
                                 const int cell_size, int enemyWidth, int enemyHeight,
-                                bool movingRight, float speed, int height, int width)
+                                bool movingRight, float speed)
 {
     float offset_x = enemyX;
 
@@ -146,13 +1032,12 @@ bool enemy_horizontal_collision(char **lvl, float enemyX, float enemyY,
         offset_x += speed;
 
         // Check right side of enemy
-        char right_top = getTile(lvl, (int)(enemyY) / cell_size, (int)(offset_x + enemyWidth) / cell_size, height, width);
-        char right_mid = getTile(lvl, (int)(enemyY + enemyHeight / 2) / cell_size, (int)(offset_x + enemyWidth) / cell_size, height, width);
-        char right_bottom = getTile(lvl, (int)(enemyY + enemyHeight - 1) / cell_size, (int)(offset_x + enemyWidth) / cell_size, height, width);
+        int col = (int)(offset_x + enemyWidth) / cell_size;
+        unsigned char right_top = tileFlags(lvl, (int)(enemyY) / cell_size, col);
+        unsigned char right_mid = tileFlags(lvl, (int)(enemyY + enemyHeight / 2) / cell_size, col);
+        unsigned char right_bottom = tileFlags(lvl, (int)(enemyY + enemyHeight - 1) / cell_size, col);
 
-        if (right_top == '#' || right_mid == '#' || right_bottom == '#' ||
-            right_top == '\\' || right_mid == '\\' || right_bottom == '\\' ||
-            right_top == '/' || right_mid == '/' || right_bottom == '/')
+        if ((right_top | right_mid | right_bottom) & TILE_SOLID)
         {
             return true; // Hit wall, change direction
         }
@@ -162,13 +1047,12 @@ bool enemy_horizontal_collision(char **lvl, float enemyX, float enemyY,
         offset_x -= speed;
 
         // Check left side of enemy
-        char left_top = getTile(lvl, (int)(enemyY) / cell_size, (int)(offset_x) / cell_size, height, width);
-        char left_mid = getTile(lvl, (int)(enemyY + enemyHeight / 2) / cell_size, (int)(offset_x) / cell_size, height, width);
-        char left_bottom = getTile(lvl, (int)(enemyY + enemyHeight - 1) / cell_size, (int)(offset_x) / cell_size, height, width);
+        int col = (int)(offset_x) / cell_size;
+        unsigned char left_top = tileFlags(lvl, (int)(enemyY) / cell_size, col);
+        unsigned char left_mid = tileFlags(lvl, (int)(enemyY + enemyHeight / 2) / cell_size, col);
+        unsigned char left_bottom = tileFlags(lvl, (int)(enemyY + enemyHeight - 1) / cell_size, col);
 
-        if (left_top == '#' || left_mid == '#' || left_bottom == '#' ||
-            left_top == '\\' || left_mid == '\\' || left_bottom == '\\' ||
-            left_top == '/' || left_mid == '/' || left_bottom == '/')
+        if ((left_top | left_mid | left_bottom) & TILE_SOLID)
         {
             return true; // Hit wall, change direction
         }
@@ -177,23 +1061,21 @@ bool enemy_horizontal_collision(char **lvl, float enemyX, float enemyY,
     return false; // No collision
 }
 
-bool end_of_platform(char **lvl, float &enemyX, float &enemyY,
+bool end_of_platform(const TileMap &lvl, float &enemyX, float &enemyY,
                      float &velocityY, const int cell_size,
                      int enemyWidth, int enemyHeight,
-                     const float gravity, int height, int width)
+                     const float gravity)
 {
     velocityY += gravity;
     float offset_y = enemyY + velocityY;
 
     // Check ground below enemy
-    char bottom_left = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX) / cell_size, height, width);
-    char bottom_mid = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX + enemyWidth / 2) / cell_size, height, width);
-    char bottom_right = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX + enemyWidth) / cell_size, height, width);
+    int row = (int)(offset_y + enemyHeight) / cell_size;
+    unsigned char bottom_left = tileFlags(lvl, row, (int)(enemyX) / cell_size);
+    unsigned char bottom_mid = tileFlags(lvl, row, (int)(enemyX + enemyWidth / 2) / cell_size);
+    unsigned char bottom_right = tileFlags(lvl, row, (int)(enemyX + enemyWidth) / cell_size);
 
-    bool hitGround = (bottom_left == '#' || bottom_mid == '#' || bottom_right == '#' ||
-                      bottom_left == '-' || bottom_mid == '-' || bottom_right == '-' ||
-                      bottom_left == '\\' || bottom_mid == '\\' || bottom_right == '\\' ||
-                      bottom_left == '/' || bottom_mid == '/' || bottom_right == '/');
+    bool hitGround = (bottom_left | bottom_mid | bottom_right) & TILE_GROUND;
 
     if (!hitGround)
     {
@@ -205,23 +1087,21 @@ bool end_of_platform(char **lvl, float &enemyX, float &enemyY,
     }
 }
 
-bool enemy_vertical_collision(char **lvl, float &enemyX, float &enemyY,
+bool enemy_vertical_collision(const TileMap &lvl, float &enemyX, float &enemyY,
                               float &velocityY, const int cell_size,
                               int enemyWidth, int enemyHeight,
-                              const float gravity, int height, int width)
+                              const float gravity)
 {
     velocityY += gravity;
     float offset_y = enemyY + velocityY;
 
     // Check ground below enemy
-    char bottom_left = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX) / cell_size, height, width);
-    char bottom_mid = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX + enemyWidth / 2) / cell_size, height, width);
-    char bottom_right = getTile(lvl, (int)(offset_y + enemyHeight) / cell_size, (int)(enemyX + enemyWidth) / cell_size, height, width);
+    int row = (int)(offset_y + enemyHeight) / cell_size;
+    unsigned char bottom_left = tileFlags(lvl, row, (int)(enemyX) / cell_size);
+    unsigned char bottom_mid = tileFlags(lvl, row, (int)(enemyX + enemyWidth / 2) / cell_size);
+    unsigned char bottom_right = tileFlags(lvl, row, (int)(enemyX + enemyWidth) / cell_size);
 
-    bool hitGround = (bottom_left == '#' || bottom_mid == '#' || bottom_right == '#' ||
-                      bottom_left == '-' || bottom_mid == '-' || bottom_right == '-' ||
-                      bottom_left == '\\' || bottom_mid == '\\' || bottom_right == '\\' ||
-                      bottom_left == '/' || bottom_mid == '/' || bottom_right == '/');
+    bool hitGround = (bottom_left | bottom_mid | bottom_right) & TILE_GROUND;
 
     if (hitGround && velocityY > 0)
     {
@@ -238,12 +1118,13 @@ bool enemy_vertical_collision(char **lvl, float &enemyX, float &enemyY,
     }
 }
 
-void player_gravity(char **lvl, float &offset_y, float &velocityY, bool &onGround,
+void player_gravity(const TileMap &lvl, float &offset_y, float &velocityY, bool &onGround,
                     const float &gravity, float &terminal_Velocity,
                     float &player_x, float &player_y,
                     const int cell_size, int &Pheight, int &Pwidth,
                     bool dropDown, float &dropCooldown, bool &victoryAnimation)
 {
+    TRACE_ZONE("player_gravity");
     velocityY += gravity;
     if (velocityY >= terminal_Velocity)
         velocityY = terminal_Velocity;
@@ -252,56 +1133,51 @@ void player_gravity(char **lvl, float &offset_y, float &velocityY, bool &onGroun
 
     if (!victoryAnimation)
     {
+        // Swept against the tiles so a fall faster than a tile per tick can't skip a platform
         if (velocityY < 0)
         {
-            char top_left = lvl[(int)(offset_y) / cell_size][(int)(player_x) / cell_size];
-            char top_mid = lvl[(int)(offset_y) / cell_size][(int)(player_x + Pwidth / 2) / cell_size];
-            char top_right = lvl[(int)(offset_y) / cell_size][(int)(player_x + Pwidth) / cell_size];
-
-            if (top_left == '#' || top_mid == '#' || top_right == '#' ||
-                top_left == '\\' || top_mid == '\\' || top_right == '\\' ||
-                top_left == '/' || top_mid == '/' || top_right == '/')
+            SweepHit ceiling = sweep_box(lvl, lvl.solidBits, player_x, player_y, Pwidth + 1, Pheight,
+                                         0, velocityY, cell_size);
+            if (ceiling.hit)
             {
                 velocityY = 0;
-                player_y = ((int)(offset_y) / cell_size + 1) * cell_size;
+                player_y = (ceiling.row + 1) * cell_size;
                 return;
             }
         }
 
         if (velocityY > 0)
         {
-            char bottom_left = lvl[(int)(offset_y + Pheight) / cell_size][(int)(player_x) / cell_size];
-            char bottom_mid = lvl[(int)(offset_y + Pheight) / cell_size][(int)(player_x + Pwidth / 2) / cell_size];
-            char bottom_right = lvl[(int)(offset_y + Pheight) / cell_size][(int)(player_x + Pwidth) / cell_size];
-
-            bool hitSolidBlock = (bottom_left == '#' || bottom_mid == '#' || bottom_right == '#' ||
-                                bottom_left == '\\' || bottom_mid == '\\' || bottom_right == '\\' ||
-                                bottom_left == '/' || bottom_mid == '/' || bottom_right == '/');
-            bool hitOneWay = (bottom_left == '-' || bottom_mid == '-' || bottom_right == '-');
-
-            if (dropDown && hitOneWay && !hitSolidBlock)
+            // First row of anything standable the feet cross this tick
+            SweepHit ground = sweep_box(lvl, lvl.groundBits, player_x, player_y, Pwidth + 1, Pheight,
+                                        0, velocityY, cell_size);
+            int colLeft = (int)floor(player_x / cell_size);
+            int colRight = (int)floor((player_x + Pwidth) / cell_size);
+            bool hitSolidBlock = ground.hit && row_range_any(lvl, lvl.solidBits, ground.row, colLeft, colRight);
+            bool hitOneWay = ground.hit && !hitSolidBlock;
+
+            if (hitOneWay && (dropDown || dropCooldown > 0))
             {
-                onGround = false;
-                player_y = offset_y;
-                dropCooldown = 0.1f;
+                // Dropping through a one-way platform, only solid tiles stop the rest of the fall
+                if (dropDown)
+                    dropCooldown = 0.1f;
+                ground = sweep_box(lvl, lvl.solidBits, player_x, player_y, Pwidth + 1, Pheight,
+                                   0, velocityY, cell_size);
+                hitSolidBlock = ground.hit;
             }
-            else if (dropCooldown > 0 && hitOneWay && !hitSolidBlock)
-            {
-                onGround = false;
-                player_y = offset_y;
-            }
-            else if (hitSolidBlock)
+
+            if (hitSolidBlock)
             {
                 onGround = true;
                 velocityY = 0;
-                player_y = ((int)(offset_y + Pheight) / cell_size) * cell_size - Pheight;
+                player_y = ground.row * cell_size - Pheight;
                 dropCooldown = 0;
             }
             else if (hitOneWay && !dropDown && dropCooldown <= 0)
             {
                 onGround = true;
                 velocityY = 0;
-                player_y = ((int)(offset_y + Pheight) / cell_size) * cell_size - Pheight;
+                player_y = ground.row * cell_size - Pheight;
             }
             else
             {
@@ -317,7 +1193,7 @@ void player_gravity(char **lvl, float &offset_y, float &velocityY, bool &onGroun
     }
 }
 
-void player_horizontal_collision(char **lvl, float &player_x, float &player_y, const int cell_size, int &Pheight, int &Pwidth, float speed, bool movingLeft, bool movingRight, bool &victoryAnimation)
+void player_horizontal_collision(const TileMap &lvl, float &player_x, float &player_y, const int cell_size, int &Pheight, int &Pwidth, float speed, bool movingLeft, bool movingRight, bool &victoryAnimation)
 {
     float offset_x = player_x;
 
@@ -327,13 +1203,12 @@ void player_horizontal_collision(char **lvl, float &player_x, float &player_y, c
         {
             offset_x -= speed;
 
-            char left_top = lvl[(int)(player_y) / cell_size][(int)(offset_x) / cell_size];
-            char left_mid = lvl[(int)(player_y + Pheight / 2) / cell_size][(int)(offset_x) / cell_size];
-            char left_bottom = lvl[(int)(player_y + Pheight - 1) / cell_size][(int)(offset_x) / cell_size];
+            int col = (int)(offset_x) / cell_size;
+            unsigned char left_top = tileFlags(lvl, (int)(player_y) / cell_size, col);
+            unsigned char left_mid = tileFlags(lvl, (int)(player_y + Pheight / 2) / cell_size, col);
+            unsigned char left_bottom = tileFlags(lvl, (int)(player_y + Pheight - 1) / cell_size, col);
 
-            if (left_top == '#' || left_mid == '#' || left_bottom == '#' ||
-                left_top == '\\' || left_mid == '\\' || left_bottom == '\\' ||
-                left_top == '/' || left_mid == '/' || left_bottom == '/')
+            if ((left_top | left_mid | left_bottom) & TILE_SOLID)
             {
                 player_x = (((int)(offset_x) / cell_size) + 1) * cell_size;
             }
@@ -347,13 +1222,12 @@ void player_horizontal_collision(char **lvl, float &player_x, float &player_y, c
         {
             offset_x = player_x + speed;
 
-            char right_top = lvl[(int)(player_y) / cell_size][(int)(offset_x + Pwidth) / cell_size];
-            char right_mid = lvl[(int)(player_y + Pheight / 2) / cell_size][(int)(offset_x + Pwidth) / cell_size];
-            char right_bottom = lvl[(int)(player_y + Pheight - 1) / cell_size][(int)(offset_x + Pwidth) / cell_size];
+            int col = (int)(offset_x + Pwidth) / cell_size;
+            unsigned char right_top = tileFlags(lvl, (int)(player_y) / cell_size, col);
+            unsigned char right_mid = tileFlags(lvl, (int)(player_y + Pheight / 2) / cell_size, col);
+            unsigned char right_bottom = tileFlags(lvl, (int)(player_y + Pheight - 1) / cell_size, col);
 
-            if (right_top == '#' || right_mid == '#' || right_bottom == '#' ||
-                right_top == '\\' || right_mid == '\\' || right_bottom == '\\' ||
-                right_top == '/' || right_mid == '/' || right_bottom == '/')
+            if ((right_top | right_mid | right_bottom) & TILE_SOLID)
             {
                 player_x = ((int)(offset_x + Pwidth) / cell_size) * cell_size - Pwidth;
             }
@@ -365,15 +1239,26 @@ void player_horizontal_collision(char **lvl, float &player_x, float &player_y, c
     }
 }
 
-void updateGhost(char **lvl, float &ghostX, float &ghostY, bool &goingRight,
-                 float &ghostSpeed, float &velocityY, const int cell_size,
-                 Sprite &ghostSpr, Texture &ghostLeftTex, Texture &ghostRightTex)
+// xorshift32, the simulation's only source of randomness. The state lives in
+// GameState so a run replays exactly from its seed and inputs.
+int sim_rand(unsigned &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (int)(state >> 1);
+}
+
+// steps > 1 catches a far enemy up on the ticks it skipped, see enemy_steps
+void updateGhost(const TileMap &lvl, float &ghostX, float &ghostY, bool &goingRight,
+                 float &ghostSpeed, float &velocityY, const int cell_size, int steps)
 {
+    TRACE_ZONE("updateGhost");
     // Move left/right but avoid entering solid tiles
-    float nextX = ghostX + (goingRight ? ghostSpeed : -ghostSpeed);
+    float nextX = ghostX + (goingRight ? ghostSpeed : -ghostSpeed) * steps;
 
     // check if moving to nextX would overlap a solid tile (ghost size 64x64)
-    if (lvl != nullptr && overlapsSolid(lvl, nextX, ghostY, 64, 64, cell_size))
+    if (overlapsSolid(lvl, nextX, ghostY, 64, 64, cell_size))
     {
         // hit a wall/block, turn around
         goingRight = !goingRight;
@@ -383,52 +1268,49 @@ void updateGhost(char **lvl, float &ghostX, float &ghostY, bool &goingRight,
         ghostX = nextX;
     }
 
-    // Change direction at screen boundaries as a fallback
-    if (ghostX > 850)
+    // Change direction near the level's side walls as a fallback
+    // (250 px from the left edge, 302 px from the right: 250..850 on the 18-column levels)
+    if (ghostX > lvl.width * cell_size - 302)
         goingRight = false;
     if (ghostX < 250)
         goingRight = true;
-
-    // Update sprite texture and position
-    if (goingRight)
-        ghostSpr.setTexture(ghostRightTex);
-    else
-        ghostSpr.setTexture(ghostLeftTex);
-
-    ghostSpr.setPosition(ghostX, ghostY);
 }
 
 void drawGhost(RenderWindow &window, Sprite &ghostSpr)
 {
-    window.draw(ghostSpr);
+    prof_draw(window, ghostSpr);
 }
 
-void updateskel(char **lvl, float &skelX, float &skelY, bool &skelgoingRight,
+// steps > 1 catches a far enemy up on the ticks it skipped: falling is still
+// integrated tick by tick, the walk is one longer stride
+void updateskel(const TileMap &lvl, float &skelX, float &skelY, bool &skelgoingRight,
                 float &skelSpeed, float &velocityY, const int cell_size,
-                Sprite &skelSpr, Texture &skelLeftTex, Texture &skelRightTex,
-                float playerX, float playerY, float &jumpCooldown, float &walkTimer, int height, int width)
+                float playerX, float playerY, float &jumpCooldown, float &walkTimer, float dt, unsigned &rng, int steps)
 {
+    TRACE_ZONE("updateskel");
     // Update vertical movement (gravity / ground snapping)
-    bool onGround = enemy_vertical_collision(lvl, skelX, skelY, velocityY, cell_size, 64, 64, 1.0f, height, width);
+    bool onGround = false;
+    for (int s = 0; s < steps; s++)
+        onGround = enemy_vertical_collision(lvl, skelX, skelY, velocityY, cell_size, 64, 64, 1.0f);
 
     // Predict next horizontal position
-    float nextX = skelX + (skelgoingRight ? skelSpeed : -skelSpeed);
+    float stride = skelSpeed * steps;
+    float nextX = skelX + (skelgoingRight ? stride : -stride);
 
     // Determine foot check coordinates (one tile ahead beneath the enemy)
     int footRow = (int)((skelY + 64) / cell_size);
     int footColAhead = (int)((skelgoingRight ? (nextX + 64) : nextX) / cell_size);
 
     // If no ground ahead, or horizontal collision ahead, turn around
-    bool groundAhead = (getTile(lvl, footRow, footColAhead, height, width) == '#' || getTile(lvl, footRow, footColAhead, height, width) == '-' ||
-                        getTile(lvl, footRow, footColAhead, height, width) == '/' || getTile(lvl, footRow, footColAhead, height, width) == '\\');
+    bool groundAhead = tile_bit(lvl, lvl.groundBits, footRow, footColAhead);
 
-    bool willHitWall = enemy_horizontal_collision(lvl, skelX, skelY, cell_size, 64, 64, skelgoingRight, skelSpeed, height, width);
+    bool willHitWall = enemy_horizontal_collision(lvl, skelX, skelY, cell_size, 64, 64, skelgoingRight, stride);
 
     if (!groundAhead || willHitWall)
     {
         skelgoingRight = !skelgoingRight;
         // recompute nextX after turning
-        nextX = skelX + (skelgoingRight ? skelSpeed : -skelSpeed);
+        nextX = skelX + (skelgoingRight ? stride : -stride);
     }
 
     // If on ground, possibly jump up to a higher platform ahead if reachable.
@@ -437,12 +1319,12 @@ void updateskel(char **lvl, float &skelX, float &skelY, bool &skelgoingRight,
     if (onGround)
     {
         // accumulate a short walk timer so skeletons don't try to jump immediately
-        walkTimer += 1.0f / 60.0f;
+        walkTimer += dt * steps;
         if (walkTimer > 2.0f)
             walkTimer = 2.0f; // clamp
         // decrement cooldown
         if (jumpCooldown > 0)
-            jumpCooldown -= 1.0f / 60.0f;
+            jumpCooldown -= dt * steps;
 
         const float skelJumpStrength = -15.0f; // negative to move upward
         int headRow = (int)(skelY / cell_size);
@@ -456,8 +1338,10 @@ void updateskel(char **lvl, float &skelX, float &skelY, bool &skelgoingRight,
         }
         else
         {
-            // 12% base chance to consider jumping
-            if ((rand() % 100) < 12)
+            // 12% base chance per tick to consider jumping; over several
+            // ticks, the chance that any of them would have
+            int chance = (int)lround(100 * (1 - pow(0.88, steps)));
+            if ((sim_rand(rng) % 100) < chance)
                 considerJump = true;
         }
 
@@ -474,13 +1358,13 @@ void updateskel(char **lvl, float &skelX, float &skelY, bool &skelgoingRight,
                     break;
 
                 // If there is a solid tile at the landing row/col, consider jumping
-                if (isSolidTile(getTile(lvl, landingRow, landingCol, height, width)))
+                if (tileFlags(lvl, landingRow, landingCol) & TILE_GROUND)
                 {
                     // Ensure vertical clearance: no solid tiles between current head and landing row
                     bool clear = true;
                     for (int r = landingRow + 1; r <= headRow - 1; ++r)
                     {
-                        if (isSolidTile(getTile(lvl, r, landingCol, height, width)))
+                        if (tileFlags(lvl, r, landingCol) & TILE_GROUND)
                         {
                             clear = false;
                             break;
@@ -502,27 +1386,19 @@ void updateskel(char **lvl, float &skelX, float &skelY, bool &skelgoingRight,
 
     // Move horizontally
     skelX = nextX;
-
-    // Update sprite based on direction
-    if (skelgoingRight)
-        skelSpr.setTexture(skelRightTex);
-    else
-        skelSpr.setTexture(skelLeftTex);
-
-    skelSpr.setPosition(skelX, skelY);
 }
 
 
 void drawskel(RenderWindow &window, Sprite &skelSpr)
 {
-    window.draw(skelSpr);
+    prof_draw(window, skelSpr);
 }
 
-void updateinvisibleman(float &invisVelocityY, char **lvl, const int cell_size, float playerY, float playerX, float &invisX, float &invisY, bool &invisGoingRight, float &invisSpeed,
-                        Sprite &invisSpr, Texture &invisLeftTex, Texture &invisRightTex, bool &isInvisible,
-                        float &invisibleTimer, float &invisibleDuration, float &nextDisappearTime, bool &Disappearing, int &invisDisappearFrame, int height, int width)
+void updateinvisibleman(float &invisVelocityY, const TileMap &lvl, const int cell_size, float playerY, float playerX, float &invisX, float &invisY, bool &invisGoingRight, float &invisSpeed,
+                        bool &isInvisible, float &invisibleTimer, float &invisibleDuration, float &nextDisappearTime, bool &Disappearing, int &invisDisappearFrame,
+                        int &frameCounter, unsigned &rng)
 {
-    static int frameCounter = 0;
+    TRACE_ZONE("updateinvisibleman");
     if (isInvisible)
     {
         invisX = playerX + 40;
@@ -546,7 +1422,7 @@ void updateinvisibleman(float &invisVelocityY, char **lvl, const int cell_size,
         invisDisappearFrame = 0;
         Disappearing = 1;
         invisibleDuration = 60;
-        nextDisappearTime = rand() % 600;
+        nextDisappearTime = sim_rand(rng) % 600;
     }
 
     if (Disappearing)
@@ -564,19 +1440,19 @@ void updateinvisibleman(float &invisVelocityY, char **lvl, const int cell_size,
             frameCounter = 0;
             isInvisible = 1;
             Disappearing = 0;
-            nextDisappearTime = rand() % 1000;
+            nextDisappearTime = sim_rand(rng) % 1000;
         }
     }
 
     if (!Disappearing && !isInvisible)
     {
         bool onGround = enemy_vertical_collision(lvl, invisX, invisY, invisVelocityY,
-                                                 cell_size, 64, 64, 1.0f, height, width);
+                                                 cell_size, 64, 64, 1.0f);
 
         if (onGround)
         {
             if (enemy_horizontal_collision(lvl, invisX, invisY, cell_size,
-                                           64, 64, invisGoingRight, invisSpeed, height, width))
+                                           64, 64, invisGoingRight, invisSpeed))
             {
                 invisGoingRight = !invisGoingRight; // Turn around at wall
             }
@@ -589,27 +1465,21 @@ void updateinvisibleman(float &invisVelocityY, char **lvl, const int cell_size,
                     invisX -= invisSpeed;
             }
         }
-        if (invisGoingRight)
-            invisSpr.setTexture(invisRightTex);
-        else
-            invisSpr.setTexture(invisLeftTex);
-
-        invisSpr.setPosition(invisX, invisY);
     }
 }
 
 
-void drawinvisibleman(RenderWindow &window, Sprite &invisSpr, bool isInvisible, bool &Disappearing, int &invisDisappearFrame, Sprite Disappear_spr[])
+void drawinvisibleman(RenderWindow &window, Sprite &invisSpr, bool isInvisible, bool Disappearing, int invisDisappearFrame, Sprite Disappear_spr[])
 {
     if (Disappearing)
     {
         Disappear_spr[invisDisappearFrame].setPosition(invisSpr.getPosition());
-        window.draw(Disappear_spr[invisDisappearFrame]);
+        prof_draw(window, Disappear_spr[invisDisappearFrame]);
     }
 
     else if (!isInvisible)
     {
-        window.draw(invisSpr);
+        prof_draw(window, invisSpr);
     }
 }
 
@@ -637,31 +1507,32 @@ bool detectPlayer(float playerX, float playerY, float enemyX, float enemyY, bool
     }
 }
 
-void updateGenova(char **lvl, const int cell_size, float playerX, float playerY,
+// steps > 1 catches a far Genova up on the ticks it skipped. It is never near
+// enough to see the player then, so only the walk needs scaling.
+void updateGenova(const TileMap &lvl, const int cell_size, float playerX, float playerY,
                   float &genovaX, float &genovaY,
                   bool &genovaGoingRight, float &genovaSpeed,
-                  Sprite &genovaSpr,
-                  Texture &genovaLeftTex, Texture &genovaRightTex,
-                  int vacuumFrame,
                   bool &isAttacking,
                   int &attackTimer,
-                  int &fireballCooldown, int height, int width)
+                  int &fireballCooldown, int steps)
 {
+    TRACE_ZONE("updateGenova");
     if (!isAttacking)
     {
         // Predict next horizontal position
-        float nextX = genovaX + (genovaGoingRight ? genovaSpeed : -genovaSpeed);
+        float stride = genovaSpeed * steps;
+        float nextX = genovaX + (genovaGoingRight ? stride : -stride);
 
         // foot check: tile below the enemy one cell ahead
         int footRow = (int)((genovaY + 64) / cell_size);
         int footColAhead = (int)((genovaGoingRight ? (nextX + 64) : nextX) / cell_size);
 
-        bool groundAhead = isSolidTile(getTile(lvl, footRow, footColAhead, height, width));
+        bool groundAhead = tile_bit(lvl, lvl.groundBits, footRow, footColAhead);
 
         // Check horizontal collision ahead
         bool willHitWall = enemy_horizontal_collision(lvl, genovaX, genovaY,
                                                       cell_size, 64, 64,
-                                                      genovaGoingRight, genovaSpeed, height, width);
+                                                      genovaGoingRight, stride);
 
         if (!groundAhead || willHitWall)
         {
@@ -673,13 +1544,6 @@ void updateGenova(char **lvl, const int cell_size, float playerX, float playerY,
         }
     }
 
-    if (genovaGoingRight)
-        genovaSpr.setTexture(genovaRightTex);
-    else
-        genovaSpr.setTexture(genovaLeftTex);
-
-    genovaSpr.setPosition(genovaX, genovaY);
-
     // Only attack if the player is within detection range AND is in front of the Genova
     bool playerDetected = (fabs(playerY - genovaY) < 50) && (fabs(playerX - genovaX) < 200);
     bool playerIsInFront = (genovaGoingRight && playerX > genovaX) || (!genovaGoingRight && playerX < genovaX);
@@ -698,7 +1562,7 @@ void updateGenova(char **lvl, const int cell_size, float playerX, float playerY,
     {
         if (isAttacking)
         {
-            // allow drawGenova to finish wind-up; if wind-up already done, cancel attack
+            // allow updateGenovaAttack to finish wind-up; if wind-up already done, cancel attack
             if (attackTimer <= 0)
                 isAttacking = false;
         }
@@ -743,35 +1607,165 @@ bool playerDodged(float X, float Y, float playerX, float playerY, bool facingRig
     }
 }
 
-void drawGenova(RenderWindow &window,
-                Sprite &genovaSpr,
-                bool &isAttacking,
-                bool facingRight,
-                int &attackTimer, float playerX, float playerY, int &fireballCooldown, bool &fireballSpawned,
-                Sprite genova_sprite[], Sprite fire_sprite[], float genovaX, float genovaY, int vacuumframe, bool &fireballActive, float &fireballX, float &fireballY, bool &fireballRight, float &fireballSpeed, bool &fireballHit,
-                int &lifeCount, float &damageCooldown, bool vacuum)
+// Genova fireballs and any other projectile, as parallel arrays. Dead slots go
+// on a free list and are reused before the arrays grow, and the arrays are
+// reserved up front, so spawning doesn't allocate in play.
+struct ProjectilePool
+{
+    vector<float> x;
+    vector<float> y;
+    vector<float> velocityX; // pixels per tick, the sign is the direction
+    vector<char> active;
+    vector<int> freeSlots;
+    int live = 0;
+};
+
+const int projectileReserve = 512;
+const int projectileSize = 23; // collision box, the 13 px fireball drawn at 1.8x
+
+void projectile_init(ProjectilePool &pool, int capacity)
 {
+    pool.x.reserve(capacity);
+    pool.y.reserve(capacity);
+    pool.velocityX.reserve(capacity);
+    pool.active.reserve(capacity);
+    pool.freeSlots.reserve(capacity);
+}
 
-    // Position animation frames at this Genova's coordinates so frames draw at correct spot
-    for (int f = 0; f < 6; ++f)
+// Frees every slot, keeps the capacity
+void projectile_clear(ProjectilePool &pool)
+{
+    pool.freeSlots.clear();
+    for (int s = (int)pool.active.size() - 1; s >= 0; s--)
     {
-        genova_sprite[f].setPosition(genovaX, genovaY);
+        pool.active[s] = false;
+        pool.freeSlots.push_back(s);
     }
+    pool.live = 0;
+}
 
-    const int windupFrames = 24; // frames of wind-up animation (0.4s)
-    if (isAttacking)
+void projectile_spawn(ProjectilePool &pool, float x, float y, float velocityX)
+{
+    int s;
+    if (!pool.freeSlots.empty())
     {
-        int frameOffset = facingRight ? 3 : 0;
+        s = pool.freeSlots.back();
+        pool.freeSlots.pop_back();
+    }
+    else
+    {
+        s = (int)pool.active.size();
+        pool.x.push_back(0);
+        pool.y.push_back(0);
+        pool.velocityX.push_back(0);
+        pool.active.push_back(false);
+    }
+    pool.x[s] = x;
+    pool.y[s] = y;
+    pool.velocityX[s] = velocityX;
+    pool.active[s] = true;
+    pool.live++;
+}
 
-        // If timer > 0, show progress through the 3-frame attack animation
-        if (attackTimer > 0)
+void projectile_free(ProjectilePool &pool, int s)
+{
+    pool.active[s] = false;
+    pool.freeSlots.push_back(s);
+    pool.live--;
+}
+
+// Moves every projectile one tick. One that runs into a solid tile burns out
+// there. One that reaches the player hits (damage unless vacuuming or on
+// cooldown, and hitThisTick is set); one that has flown past the player is
+// dodged. Either way it is freed.
+void update_projectiles(ProjectilePool &pool, const TileMap &lvl, int cell_size, float playerX, float playerY,
+                        int &lifeCount, float &damageCooldown, bool vacuum, bool &hitThisTick)
+{
+    const int slots = (int)pool.active.size();
+    for (int s = 0; s < slots; s++)
+    {
+        if (!pool.active[s])
+            continue;
+
+        SweepHit wall = sweep_box(lvl, lvl.solidBits, pool.x[s], pool.y[s], projectileSize, projectileSize,
+                                  pool.velocityX[s], 0, cell_size);
+        if (wall.hit)
+        {
+            projectile_free(pool, s);
+            continue;
+        }
+
+        pool.x[s] += pool.velocityX[s];
+
+        if (hitPlayer(pool.x[s], pool.y[s], playerX, playerY))
         {
-            // compute a 0..2 frame index based on progress
-            int progress = windupFrames - attackTimer;
-            int attackFrameIdx = (progress * 3) / max(1, windupFrames);
-            attackFrameIdx = max(0, min(2, attackFrameIdx));
-            window.draw(genova_sprite[attackFrameIdx + frameOffset]);
+            if (!vacuum && damageCooldown <= 0.0f)
+            {
+                if (lifeCount > -1)
+                {
+                    lifeCount -= 1;
+                }
+                damageCooldown = 2.0f;
+            }
+            hitThisTick = true;
+            projectile_free(pool, s);
+        }
+        else if (playerDodged(pool.x[s], pool.y[s], playerX, playerY, pool.velocityX[s] > 0))
+        {
+            projectile_free(pool, s);
+        }
+    }
+}
+
+// All projectiles inside the view as one textured vertex array, one draw call.
+// Each is drawn alpha of the way from its previous position to its current one.
+void draw_projectiles(RenderWindow &window, const vector<float> &xs, const vector<float> &ys,
+                      const vector<float> &prevXs, const vector<float> &prevYs, float alpha, const TextureAtlas &atlas,
+                      const AtlasFrame &frame, float scale, const View &camera, VertexArray &batch)
+{
+    batch.setPrimitiveType(Triangles);
+    batch.clear();
+
+    const IntRect &r = frame.rect;
+    float w = r.width * scale;
+    float h = r.height * scale;
+    float u = r.left;
+    float v = r.top;
+    float viewLeft = camera.getCenter().x - camera.getSize().x / 2;
+    float viewTop = camera.getCenter().y - camera.getSize().y / 2;
+    float viewRight = viewLeft + camera.getSize().x;
+    float viewBottom = viewTop + camera.getSize().y;
+
+    for (size_t s = 0; s < xs.size(); s++)
+    {
+        float x = prevXs[s] + (xs[s] - prevXs[s]) * alpha;
+        float y = prevYs[s] + (ys[s] - prevYs[s]) * alpha;
+        if (x + w < viewLeft || x > viewRight || y + h < viewTop || y > viewBottom)
+            continue;
+
+        batch.append(Vertex(Vector2f(x, y), Vector2f(u, v)));
+        batch.append(Vertex(Vector2f(x + w, y), Vector2f(u + r.width, v)));
+        batch.append(Vertex(Vector2f(x + w, y + h), Vector2f(u + r.width, v + r.height)));
+        batch.append(Vertex(Vector2f(x, y), Vector2f(u, v)));
+        batch.append(Vertex(Vector2f(x + w, y + h), Vector2f(u + r.width, v + r.height)));
+        batch.append(Vertex(Vector2f(x, y + h), Vector2f(u, v + r.height)));
+    }
+
+    if (batch.getVertexCount() > 0 && !atlas.pages.empty())
+        prof_draw(window, batch, RenderStates(&atlas.pages[frame.page]));
+}
 
+// Genova's wind-up: when the timer runs out the fireball goes into the projectile pool
+void updateGenovaAttack(bool &isAttacking,
+                        bool facingRight,
+                        int &attackTimer, int &fireballCooldown, bool &fireballSpawned,
+                        float genovaX, float genovaY, ProjectilePool &projectiles, float fireballSpeed)
+{
+    if (isAttacking)
+    {
+        // If timer > 0, the wind-up animation is still playing
+        if (attackTimer > 0)
+        {
             // decrement timer
             attackTimer -= 1;
 
@@ -780,10 +1774,7 @@ void drawGenova(RenderWindow &window,
             {
                 if ((!fireballSpawned) && fireballCooldown <= 0)
                 {
-                    fireballActive = true;
-                    fireballX = genovaX;
-                    fireballY = genovaY + 10;
-                    fireballRight = facingRight;
+                    projectile_spawn(projectiles, genovaX, genovaY + 10, facingRight ? fireballSpeed : -fireballSpeed);
                     // set cooldown to 4 seconds (assuming 60 FPS)
                     fireballCooldown = 240;
                     fireballSpawned = true;
@@ -795,1732 +1786,4256 @@ void drawGenova(RenderWindow &window,
         }
         else
         {
-            // fallback: draw first attack frame if timer is unexpectedly zero
-            window.draw(genova_sprite[0 + frameOffset]);
+            // fallback: timer is unexpectedly zero
             isAttacking = false;
         }
     }
     else
     {
-        window.draw(genovaSpr);
         fireballSpawned = false;
     }
-    if (fireballActive)
-    {
-        if (fireballRight)
-        {
-            fireballX += fireballSpeed;
-        }
-
-        else
-        {
-            fireballX -= fireballSpeed;
-        }
-
-        fire_sprite[vacuumframe / 5].setPosition(fireballX, fireballY);
-        window.draw(fire_sprite[vacuumframe / 5]);
-
-        // If the fireball hits the player, mark the hit and deactivate the fireball.
-        if (hitPlayer(fireballX, fireballY, playerX, playerY))
-        {
-            // Apply damage immediately if not vacuuming and cooldown allows
-            if (!vacuum && damageCooldown <= 0.0f)
-            {
-                if (lifeCount > -1)
-                {
-                    lifeCount -= 1;
-                }
-                damageCooldown = 2.0f;
-            }
-
-            fireballActive = false;
-            fireballSpawned = false;
-            fireballHit = true;
-        }
-        else if (playerDodged(fireballX, fireballY, playerX, playerY, facingRight))
-        {
-            // If player dodged, simply deactivate the fireball without marking a hit
-            fireballActive = false;
-            fireballSpawned = false;
-        }
-    }
 }
 
-
-void level1(char **lvl, Texture &bgTex, Sprite &bgSprite, Texture &blockTexture, Sprite &blockSprite, Texture &oneWayTexture, Sprite &oneWaySprite)
+void drawGenova(RenderWindow &window,
+                Sprite &genovaSpr,
+                bool isAttacking,
+                bool facingRight,
+                int attackTimer,
+                Sprite genova_sprite[], float genovaX, float genovaY)
 {
-    // Load textures with error checking
-    bgTex.loadFromFile("Data/bg.png");
-    bgSprite.setTexture(bgTex);
-    bgSprite.setPosition(0, 0);
-
-    blockTexture.loadFromFile("Data/block1.png");
-    blockSprite.setTexture(blockTexture);
-
-    oneWayTexture.loadFromFile("Data/block1.png");
-    oneWaySprite.setTexture(oneWayTexture);
-
-    for (int i = 0; i < 18; i++)
-        lvl[0][i] = '#';
-    for (int i = 0; i < 13; i++)
-        lvl[i][17] = '#';
-    for (int i = 0; i < 13; i++)
-        lvl[i][0] = '#';
-    for (int i = 0; i < 18; i++)
-        lvl[13][i] = '#';
-
-    for (int i = 3; i < 15; i++)
-        lvl[3][i] = '-';
-    for (int i = 3; i < 15; i++)
-        lvl[11][i] = '-';
-
-    for (int i = 3; i < 15; i++)
-    {
-        if (!((i == 8) || (i == 9)))
-            lvl[7][i] = '-';
-    }
-    for (int i = 0; i < 17; i++)
-    {
-        if (i < 5 || i > 12)
-            lvl[5][i] = '-';
-    }
-    for (int i = 0; i < 17; i++)
-    {
-        if (i < 5 || i > 12)
-            lvl[9][i] = '-';
-    }
-
-    lvl[3][8] = '#';
-    lvl[3][9] = '#';
-    lvl[4][8] = '#';
-    lvl[4][9] = '#';
-    lvl[5][8] = '#';
-    lvl[5][9] = '#';
-    lvl[5][7] = '#';
-    lvl[5][10] = '#';
-    lvl[6][9] = '#';
-    lvl[6][8] = '#';
-    lvl[7][9] = '#';
-    lvl[7][8] = '#';
-    lvl[8][9] = '#';
-    lvl[8][8] = '#';
-    lvl[10][8] = '#';
-    lvl[10][9] = '#';
-    lvl[9][8] = '#';
-    lvl[9][9] = '#';
-    lvl[9][7] = '#';
-    lvl[9][10] = '#';
-    lvl[6][7] = '#';
-    lvl[6][10] = '#';
-    lvl[7][7] = '#';
-    lvl[7][10] = '#';
-    lvl[8][7] = '#';
-    lvl[8][10] = '#';
-}
-
-void level2(char **lvl, Texture &bgTex, Sprite &bgSprite, Texture &blockTexture, Sprite &blockSprite, Texture &slopeTexture, Sprite &slopeSprite, Texture &slopeBotTexture, Sprite &slopeBotSprite, Texture &oneWayTexture, Sprite &oneWaySprite)
-{
-    // Load textures with error checking
-    bgTex.loadFromFile("Data/bg2.png");
-    bgSprite.setTexture(bgTex);
-    bgSprite.setPosition(0, 0);
-
-    blockTexture.loadFromFile("Data/block2.png");
-    blockSprite.setTexture(blockTexture);
-
-    slopeTexture.loadFromFile("Data/slope.png");
-    slopeSprite.setTexture(slopeTexture);
+    TRACE_ZONE("drawGenova");
 
-    slopeBotTexture.loadFromFile("Data/slope_bottom.png");
-    slopeBotSprite.setTexture(slopeBotTexture);
-
-    oneWayTexture.loadFromFile("Data/block2.png");
-    oneWaySprite.setTexture(oneWayTexture);
-
-    for (int i = 0; i < 18; i++) // for upper line
+    // Position animation frames at this Genova's coordinates so frames draw at correct spot
+    for (int f = 0; f < 6; ++f)
     {
-
-        lvl[0][i] = '#';
+        genova_sprite[f].setPosition(genovaX, genovaY);
     }
 
-    for (int i = 0; i < 13; i++) // for right line
+    const int windupFrames = 24; // frames of wind-up animation (0.4s)
+    if (isAttacking)
     {
+        int frameOffset = facingRight ? 3 : 0;
 
-        lvl[i][17] = '#';
+        // updateGenovaAttack already ticked the timer this frame, so add it back
+        // to get a 0..2 frame index based on progress
+        int progress = windupFrames - (attackTimer + 1);
+        int attackFrameIdx = (progress * 3) / max(1, windupFrames);
+        attackFrameIdx = max(0, min(2, attackFrameIdx));
+        prof_draw(window, genova_sprite[attackFrameIdx + frameOffset]);
     }
-    for (int i = 0; i < 13; i++) // for left line
+    else
     {
-
-        lvl[i][0] = '#';
+        prof_draw(window, genovaSpr);
     }
-    for (int i = 0; i < 18; i++) // for lower line
-    {
+}
 
-        lvl[13][i] = '#';
-    }
 
-    for (int i = 0; i < 17; i++)
+// Largest backpack a level may ask for
+const int backpackMax = 16;
+
+// One enemy placement from a level file. The jump delays hold a skeleton
+// back for a moment after the level starts, 0 means jump right away.
+struct LevelSpawn
+{
+    int type = 0; // 0 = Ghost, 1 = Skeleton, 2 = Invisible Man, 3 = Genova
+    int col = 0;
+    int row = 0;
+    float jumpCooldown = 0;
+    float walkTimer = 0;
+};
+
+// Everything a level file describes. Texture paths may be empty when the
+// level has no tiles of that kind.
+struct LevelData
+{
+    string path; // file it was loaded from, for messages
+    int width = 0;
+    int height = 0;
+    vector<char> tiles; // row-major, ' ' for empty
+    string background;
+    string tileset[TILE_KINDS]; // indexed by TILE_BLOCK, TILE_ONEWAY, ...
+    float playerX = 0;
+    float playerY = 0;
+    int backpack = 3; // enemies the vacuum holds at once
+    vector<LevelSpawn> spawns;
+};
+
+// Every level in play order, level n is levelTable[n - 1]
+vector<LevelData> levelTable;
+const string levelDir = "Data/levels";
+
+const char *levelSpawnNames[] = {"ghost", "skeleton", "invisible", "genova"};
+const char *levelTilesetKeys[TILE_KINDS] = {"block", "oneway", "slope", "slope_bottom"};
+
+// Tiles larger than this are almost certainly a corrupt file
+const int levelMaxSide = 4096;
+
+bool valid_level_tile(char t)
+{
+    return t == ' ' || t == '#' || t == '-' || t == '/' || t == '\\';
+}
+
+// Shared checks for both forms, fills error and returns false on the first problem
+bool check_level(const LevelData &ld, string &error)
+{
+    if (ld.width <= 0 || ld.height <= 0 || ld.width > levelMaxSide || ld.height > levelMaxSide)
+        error = "bad size " + to_string(ld.width) + "x" + to_string(ld.height);
+    else if ((int)ld.tiles.size() != ld.width * ld.height)
+        error = "map has " + to_string(ld.tiles.size()) + " tiles, size says " + to_string(ld.width * ld.height);
+    else if (ld.backpack < 1 || ld.backpack > backpackMax)
+        error = "backpack must be 1.." + to_string(backpackMax);
+    if (!error.empty())
+        return false;
+
+    for (char t : ld.tiles)
     {
-        if (!((i >= 3 && i <= 5)) && !(i > 15))
+        if (!valid_level_tile(t))
         {
-            lvl[3][i] = '-';
+            error = string("unknown tile '") + t + "'";
+            return false;
         }
     }
-    for (int i = 0; i < 17; i++)
+    for (const LevelSpawn &s : ld.spawns)
     {
-        if ((i >= 1 && i <= 4) || (i >= 11 && i <= 12) || (i >= 15))
+        if (s.type < 0 || s.type > 3 || s.col < 0 || s.col >= ld.width || s.row < 0 || s.row >= ld.height)
         {
-            lvl[11][i] = '-';
+            error = "spawn at " + to_string(s.col) + "," + to_string(s.row) + " is outside the map";
+            return false;
         }
     }
+    return true;
+}
 
-    for (int i = 0; i < 15; i++)
+// Text form, for authoring. One directive per line, ';' starts a comment line:
+//
+//   size 18 14                   columns and rows
+//   background Data/bg.png
+//   block Data/block1.png        tileset image for '#', likewise oneway '-',
+//                                slope '/' and slope_bottom '\'
+//   player 200 150               start position in pixels
+//   backpack 3
+//   spawn skeleton 2 3 1.2 0.3   type, column, row, optional jump cooldown and walk time
+//   map                          followed by one line per row, '.' is empty
+bool parse_level_text(const string &text, LevelData &ld, string &error)
+{
+    istringstream in(text);
+    string line;
+    int lineNo = 0;
+    while (getline(in, line))
     {
-        if ((i >= 1 && i <= 2) || (i >= 10 && i <= 13))
+        lineNo++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        istringstream words(line);
+        string key;
+        if (!(words >> key) || key[0] == ';')
+            continue;
+
+        bool ok = true;
+        if (key == "size")
         {
-            lvl[7][i] = '-';
+            ok = (bool)(words >> ld.width >> ld.height);
         }
-    }
-    for (int i = 0; i < 17; i++)
-    {
-        if ((i == 1) || (i >= 8 && i <= 10) || (i >= 13))
+        else if (key == "background")
         {
-            lvl[5][i] = '-';
+            ok = (bool)(words >> ld.background);
         }
-    }
-    for (int i = 0; i < 17; i++)
-    {
-        if ((i >= 1 && i <= 3) || (i >= 12 && i <= 14) || (i == 16))
+        else if (key == "player")
         {
-            lvl[9][i] = '-';
+            ok = (bool)(words >> ld.playerX >> ld.playerY);
         }
-    }
-
-    for (int i = 3; i < 17; i++)
-    {
-        int j = i + 1;
-        if (j < 12 && i < 12)
+        else if (key == "backpack")
+        {
+            ok = (bool)(words >> ld.backpack);
+        }
+        else if (key == "spawn")
+        {
+            LevelSpawn s;
+            string type;
+            ok = (bool)(words >> type >> s.col >> s.row);
+            s.type = -1;
+            for (int t = 0; t < 4; t++)
+            {
+                if (type == levelSpawnNames[t] || type == to_string(t))
+                    s.type = t;
+            }
+            if (words >> s.jumpCooldown)
+                words >> s.walkTimer;
+            ld.spawns.push_back(s);
+        }
+        else if (key == "map")
+        {
+            if (ld.width <= 0 || ld.height <= 0 || ld.width > levelMaxSide || ld.height > levelMaxSide)
+            {
+                error = "line " + to_string(lineNo) + ": map before a valid size";
+                return false;
+            }
+            ld.tiles.assign(ld.width * ld.height, ' ');
+            for (int r = 0; r < ld.height && getline(in, line); r++)
+            {
+                lineNo++;
+                for (int c = 0; c < ld.width && c < (int)line.size(); c++)
+                {
+                    if (line[c] != '.' && line[c] != '\r')
+                        ld.tiles[r * ld.width + c] = line[c];
+                }
+            }
+        }
+        else
         {
-            lvl[i][i] = '/';
-            lvl[j][i] = '\\';
-            if (j < 11)
+            int kind = -1;
+            for (int k = 0; k < TILE_KINDS; k++)
+            {
+                if (key == levelTilesetKeys[k])
+                    kind = k;
+            }
+            if (kind < 0)
             {
-                lvl[j + 1][i] = '\\';
+                error = "line " + to_string(lineNo) + ": unknown directive '" + key + "'";
+                return false;
             }
+            ok = (bool)(words >> ld.tileset[kind]);
+        }
+
+        if (!ok)
+        {
+            error = "line " + to_string(lineNo) + ": bad '" + key + "'";
+            return false;
         }
     }
+    return check_level(ld, error);
+}
+
+// Binary form, what ships. The whole file is one read, little-endian:
+//   "TPLVL1\0\0", width i32, height i32, backpack i32, spawn count i32,
+//   player x f32, player y f32, width * height tile chars,
+//   per spawn type i32, col i32, row i32, jump cooldown f32, walk timer f32,
+//   then background and the TILE_KINDS tileset paths, each a u16 length and the bytes
+bool level_take(const string &bytes, size_t &pos, void *out, size_t size)
+{
+    if (pos + size > bytes.size())
+        return false;
+    memcpy(out, bytes.data() + pos, size);
+    pos += size;
+    return true;
 }
 
-void startLevel(int &selectedLevel, int height, int width, int &lifeCount, float &player_x, float &player_y, float &velocityY, bool &onGround, float &damageCooldown, float &dropCooldown,
-                char **lvl, Texture &bgTex, Sprite &bgSprite, Texture &blockTexture, Sprite &blockSprite, Texture &oneWayTexture, Sprite &oneWaySprite,
-                Texture &slopeTexture, Sprite &slopeSprite, Texture &slopeBotTexture, Sprite &slopeBotSprite, bool &spacePressed, Music &lvlMusic,
-                int enemyTypes[], float enemyX[], float enemyY[], bool enemyDisappeared[], bool enemySucked[], bool enemyThrown[], float enemyVelocityY[], bool enemyGoingRight[], float enemyThrowVelocityX[], float enemyThrowVelocityY[], 
-                int MAX_ENEMIES, const int cell_size)
+bool level_take_string(const string &bytes, size_t &pos, string &out)
 {
-    for (int i = 0; i < height; i++)
-        for (int j = 0; j < width; j++)
-            lvl[i][j] = ' ';
+    unsigned short length = 0;
+    if (!level_take(bytes, pos, &length, 2) || pos + length > bytes.size())
+        return false;
+    out.assign(bytes, pos, length);
+    pos += length;
+    return true;
+}
 
-    if (selectedLevel == 1)
+bool parse_level_binary(const string &bytes, LevelData &ld, string &error)
+{
+    size_t pos = 8;
+    int spawnCount = 0;
+    bool ok = level_take(bytes, pos, &ld.width, 4) && level_take(bytes, pos, &ld.height, 4) &&
+              level_take(bytes, pos, &ld.backpack, 4) && level_take(bytes, pos, &spawnCount, 4) &&
+              level_take(bytes, pos, &ld.playerX, 4) && level_take(bytes, pos, &ld.playerY, 4);
+    if (ok && (ld.width <= 0 || ld.height <= 0 || ld.width > levelMaxSide || ld.height > levelMaxSide ||
+               spawnCount < 0 || spawnCount > ld.width * ld.height))
     {
-        player_x = 200;
-        player_y = 150;
+        error = "corrupt header";
+        return false;
+    }
 
-        level1(lvl, bgTex, bgSprite, blockTexture, blockSprite, oneWayTexture, oneWaySprite);
+    if (ok)
+    {
+        ld.tiles.resize(ld.width * ld.height);
+        ok = level_take(bytes, pos, ld.tiles.data(), ld.tiles.size());
     }
-    else if (selectedLevel == 2)
+    for (int i = 0; ok && i < spawnCount; i++)
     {
-        player_x = 400;
-        player_y = 150;
-
-        level2(lvl, bgTex, bgSprite, blockTexture, blockSprite, slopeTexture, slopeSprite, slopeBotTexture, slopeBotSprite, oneWayTexture, oneWaySprite);
+        LevelSpawn s;
+        ok = level_take(bytes, pos, &s.type, 4) && level_take(bytes, pos, &s.col, 4) &&
+             level_take(bytes, pos, &s.row, 4) && level_take(bytes, pos, &s.jumpCooldown, 4) &&
+             level_take(bytes, pos, &s.walkTimer, 4);
+        ld.spawns.push_back(s);
     }
+    ok = ok && level_take_string(bytes, pos, ld.background);
+    for (int k = 0; ok && k < TILE_KINDS; k++)
+        ok = level_take_string(bytes, pos, ld.tileset[k]);
 
-    lifeCount = 3;
-    velocityY = 0;
-    onGround = false;
-    damageCooldown = 0.0f;
-    dropCooldown = 0.0f;
-
-    lvlMusic.play();
-    lvlMusic.setLoop(true);
-    spacePressed = true;
-
-    // ===== FIXED VERSION: Properly declare and initialize arrays =====
-    const int defaultSpawnCols[10] = {3, 2, 10, 14, 9, 16, 7, 12, 15, 9};
-    const int defaultSpawnRows[10] = {6, 3, 9, 3, 11, 12, 7, 6, 8, 12};
-
-    for (int i = 0; i < MAX_ENEMIES; i++)
+    if (!ok)
     {
-        enemyTypes[i] = i % 4;
-        enemyDisappeared[i] = false;
-        enemySucked[i] = false;
-        enemyThrown[i] = false;
-        enemyVelocityY[i] = 0;
-        enemyGoingRight[i] = true;
-        enemyThrowVelocityX[i] = 0;
-        enemyThrowVelocityY[i] = 0;
-
-        int spawnCol = defaultSpawnCols[i];
-        int spawnRow = defaultSpawnRows[i];
-        
-        findValidSpawn(lvl, spawnRow, spawnCol, enemyTypes[i], height, width);
-        
-        enemyX[i] = spawnCol * cell_size;
-        enemyY[i] = spawnRow * cell_size;
+        error = "file is truncated";
+        return false;
     }
-
-    lvlMusic.play();
-    lvlMusic.setLoop(true);
-    spacePressed = true;
+    return check_level(ld, error);
 }
 
-int main()
+bool save_level_binary(const LevelData &ld, const string &path)
 {
-    RenderWindow window(VideoMode(screen_x, screen_y), "Tumble-POP", Style::Resize);
-    window.setVerticalSyncEnabled(true);
-    window.setFramerateLimit(60);
-
-    const int cell_size = 64;
-    const int height = 14;
-    const int width = 18;
-    char **lvl;
-
-    int gameState = 0;
-    int selectedLevel = 1;
-
-    float player_x = 500;
-    float player_y = 150;
-
-    sf::Color darkBlue(200, 0, 10, 255);
-    sf::Color lightWhite(0, 0, 0);
-    Texture bgmenutex;
-    Sprite bgmenusprite;
-
-    if (!bgmenutex.loadFromFile("Data/tumblebg.jpg")) // bg load
-        cout << "Failed to load tumblebg.png" << endl;
+    ofstream out(path, ios::binary);
+    if (!out)
+        return false;
 
-    bgmenusprite.setTexture(bgmenutex);
-    bgmenusprite.setPosition(0, 0);
+    int spawnCount = (int)ld.spawns.size();
+    out.write("TPLVL1\0\0", 8);
+    out.write((const char *)&ld.width, 4);
+    out.write((const char *)&ld.height, 4);
+    out.write((const char *)&ld.backpack, 4);
+    out.write((const char *)&spawnCount, 4);
+    out.write((const char *)&ld.playerX, 4);
+    out.write((const char *)&ld.playerY, 4);
+    out.write(ld.tiles.data(), ld.tiles.size());
+    for (const LevelSpawn &s : ld.spawns)
+    {
+        out.write((const char *)&s.type, 4);
+        out.write((const char *)&s.col, 4);
+        out.write((const char *)&s.row, 4);
+        out.write((const char *)&s.jumpCooldown, 4);
+        out.write((const char *)&s.walkTimer, 4);
+    }
 
-    Texture logoTex;
-    Sprite logoSprite;
+    const string *strings[1 + TILE_KINDS] = {&ld.background};
+    for (int k = 0; k < TILE_KINDS; k++)
+        strings[1 + k] = &ld.tileset[k];
+    for (const string *s : strings)
+    {
+        unsigned short length = (unsigned short)min(s->size(), (size_t)65535);
+        out.write((const char *)&length, 2);
+        out.write(s->data(), length);
+    }
+    return (bool)out;
+}
 
-    if (!logoTex.loadFromFile("Data/logo.png")) // logo load
-        cout << "Failed to load logo.png" << endl;
+// Reads a level in either form, told apart by the binary magic
+bool load_level(const string &path, LevelData &ld)
+{
+    TRACE_ZONE("load_level");
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+        return false;
+    string bytes((size_t)file.tellg(), '\0');
+    file.seekg(0);
+    file.read(&bytes[0], bytes.size());
+
+    ld = LevelData();
+    ld.path = path;
+    string error;
+    bool ok;
+    if (bytes.compare(0, 8, string("TPLVL1\0\0", 8)) == 0)
+        ok = parse_level_binary(bytes, ld, error);
+    else
+        ok = parse_level_text(bytes, ld, error);
 
-    Texture bgTex;
-    Sprite bgSprite;
-    Texture blockTexture;
-    Sprite blockSprite;
-    Texture slopeTexture;
-    Sprite slopeSprite;
-    Texture Disappear[6];
-    Sprite Disappear_spr[6];
-    Texture slopeBotTexture;
-    Sprite slopeBotSprite;
+    if (!ok)
+        cout << "Failed to load " << path << ": " << error << endl;
+    return ok;
+}
 
-    Texture rainbow_tex[16];
-    Sprite rainbow_sprite[16];
-    Texture heartTex[3];
-    Sprite heartSpr[3];
-    Texture walk_tex[8];
-    Sprite walk_sprite[8];
-    Texture victoryTex[4];
-    Sprite victorySpr[4];
-    Texture playerLogoTex;
-    Sprite playerLogoSpr;
-    Texture playerNumTex;
-    Sprite playerNumSpr;
-    const int backCapLevel1 = 3;
-    const int backCapLevel2 = 5;
-    int backpackLevel1[backCapLevel1]; // 0 = Ghost, 1 = Skeleton, 2 = Invisible Man, 3 = Genova
-    int backpackLevel2[backCapLevel2];
-    int backCountLevel1 = 0;
-    int backCountLevel2 = 0;
-    bool isInvisible = false;
-    float invisibleTimer = 0;
-    float invisibleDuration = 0;
-    bool Disappearing = 0;
-    int invisDisappearFrame = 0;
-    srand(time(NULL));
-    float nextDisappearTime = rand() % 1000;
-    for (int i = 0; i < 6; i++)
+// Reads dir/level1, dir/level2, ... until one is missing. A level's .lvl is
+// used when present, otherwise its .txt.
+int load_level_set(const string &dir, vector<LevelData> &levels)
+{
+    TRACE_ZONE("load_level_set");
+    levels.clear();
+    for (int n = 1;; n++)
     {
-        string file = "Data/invisible/getinvisible_" + to_string(i) + ".png";
-        if (!Disappear[i].loadFromFile(file))
-        {
-            cout << " Error loading disappearing textures! " << "\n";
-        }
-        Disappear_spr[i].setTexture(Disappear[i]);
-        Disappear_spr[i].setScale(1.8, 1.8);
+        string base = dir + "/level" + to_string(n);
+        LevelData ld;
+        if (!load_level(base + ".lvl", ld) && !load_level(base + ".txt", ld))
+            break;
+        levels.push_back(ld);
     }
+    return (int)levels.size();
+}
 
-    for (int i = 0; i < 4; i++)
+// Decoded textures shared by every caller. Lookups go by path first and then
+// by a hash of the file contents, so each distinct image is decoded once per
+// process no matter how many paths or level restarts ask for it.
+struct ResourceCache
+{
+    vector<unique_ptr<Texture>> textures; // owns every decoded texture
+    map<string, Texture *> byPath;
+    map<unsigned long long, Texture *> byHash;
+    int hits = 0;       // path seen before, no disk I/O
+    int sharedHits = 0; // new path but identical bytes, read but not decoded
+    int misses = 0;     // read and decoded
+};
+
+// FNV-1a, plenty for telling asset files apart
+unsigned long long hash_bytes(const string &bytes)
+{
+    unsigned long long h = 1469598103934665603ULL;
+    for (unsigned char c : bytes)
     {
-        string filename = "Data/vacuum/" + to_string(i + 1) + ".png";
-        if (!rainbow_tex[i].loadFromFile(filename))
-            cout << "Failed to load " << filename << endl;
-        rainbow_sprite[i].setTexture(rainbow_tex[i]);
-        rainbow_sprite[i].setPosition(player_x, player_y);
+        h ^= c;
+        h *= 1099511628211ULL;
     }
+    return h;
+}
 
-    for (int i = 4; i < 16; i++)
-    {
-        string filename = "Data/vacuum/" + to_string(i + 1) + ".png";
-        if (!rainbow_tex[i].loadFromFile(filename))
-            cout << "Failed to load " << filename << endl;
-        rainbow_sprite[i].setTexture(rainbow_tex[i]);
-        rainbow_sprite[i].setPosition(player_x, player_y);
-    }
+// Points path at an already decoded texture with the same content hash.
+// Returns nullptr when nothing matches and the caller has to decode.
+Texture *cache_share(ResourceCache &cache, const string &path, unsigned long long h)
+{
+    map<unsigned long long, Texture *>::iterator same = cache.byHash.find(h);
+    if (same == cache.byHash.end())
+        return nullptr;
+    cache.sharedHits++;
+    cache.byPath[path] = same->second;
+    return same->second;
+}
 
-    for (int i = 0; i < 3; i++)
+// Makes an empty texture for a new path / content pair, the caller fills it
+Texture *cache_insert(ResourceCache &cache, const string &path, unsigned long long h)
+{
+    cache.misses++;
+    cache.textures.push_back(unique_ptr<Texture>(new Texture()));
+    Texture *tex = cache.textures.back().get();
+    cache.byPath[path] = tex;
+    cache.byHash[h] = tex;
+    return tex;
+}
+
+const Texture *get_texture(ResourceCache &cache, const string &path)
+{
+    map<string, Texture *>::iterator found = cache.byPath.find(path);
+    if (found != cache.byPath.end())
     {
-        heartTex[i].loadFromFile("Data/heart.png");
+        cache.hits++;
+        return found->second;
     }
 
-    for (int i = 0; i < 3; i++)
+    ifstream file(path, ios::binary);
+    string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (!file || bytes.empty())
     {
-        heartSpr[i].setTexture(heartTex[i]);
+        // An empty texture kept under this path only: every missing file hashes
+        // the same, so sharing by content would hand one path's entry to all of them
+        cout << "Failed to load " << path << endl;
+        cache.misses++;
+        cache.textures.push_back(unique_ptr<Texture>(new Texture()));
+        cache.byPath[path] = cache.textures.back().get();
+        return cache.byPath[path];
     }
 
-    for (int i = 0; i < 8; i++)
+    unsigned long long h = hash_bytes(bytes);
+    Texture *tex = cache_share(cache, path, h);
+    if (tex != nullptr)
+        return tex;
+
+    tex = cache_insert(cache, path, h);
+    if (!tex->loadFromMemory(bytes.data(), bytes.size()))
     {
-        string filename = "Data/walk/" + to_string(i) + ".png";
-        if (!walk_tex[i].loadFromFile(filename))
-            cout << "Failed to load " << filename << endl;
-        walk_sprite[i].setTexture(walk_tex[i]);
-        walk_sprite[i].setPosition(player_x, player_y);
+        cout << "Failed to decode " << path << endl;
+        cache.byHash.erase(h);
     }
+    return tex;
+}
 
-    for (int i = 0; i < 4; i++)
+// Same as get_texture for an image the AssetLoader already decoded; only the upload happens here
+const Texture *cache_decoded_image(ResourceCache &cache, const string &path, unsigned long long h, const Image &img)
+{
+    map<string, Texture *>::iterator found = cache.byPath.find(path);
+    if (found != cache.byPath.end())
     {
-        string filename = "Data/victory/" + to_string(i) + ".png";
-        if (!victoryTex[i].loadFromFile(filename))
-            cout << "Failed to load " << filename << endl;
-        victorySpr[i].setTexture(victoryTex[i]);
-        victorySpr[i].setPosition(player_x, player_y);
+        cache.hits++;
+        return found->second;
     }
 
-    playerLogoTex.loadFromFile("Data/player_logo.png");
-    playerLogoSpr.setTexture(playerLogoTex);
-    playerLogoSpr.setScale(1.5, 1.5);
-    playerLogoSpr.setPosition(8, 8);
+    Texture *tex = cache_share(cache, path, h);
+    if (tex != nullptr)
+        return tex;
 
-    playerNumTex.loadFromFile("Data/player_num.png");
-    playerNumSpr.setTexture(playerNumTex);
-    playerNumSpr.setScale(2.5, 2.5);
-    playerNumSpr.setPosition(64, 12);
+    tex = cache_insert(cache, path, h);
+    tex->loadFromImage(img);
+    return tex;
+}
 
-    Music lvlMusic;
-    if (!lvlMusic.openFromFile("Data/mus.ogg"))
-        cout << "Failed to load mus.ogg" << endl;
-    lvlMusic.setVolume(20);
+// Reads and decodes image files on worker threads into sf::Image. Nothing here
+// touches OpenGL, textures are created from the images on the render thread.
+struct AssetLoader
+{
+    vector<string> files;
+    vector<Image> images;
+    vector<char> ok;
+    vector<unsigned long long> hashes; // content hash for the ResourceCache
+    atomic<int> next{0};
+    atomic<int> done{0};
+    vector<thread> workers;
+};
+
+void asset_worker(AssetLoader *loader)
+{
+    while (true)
+    {
+        int i = loader->next.fetch_add(1);
+        if (i >= (int)loader->files.size())
+            break;
 
-    float speed = 5;
-    float dropTimer = 0.0f;
-    const float dropDuration = 0.15f;
-    const float jumpStrength = -17;
-    const float gravity = 1;
+        TRACE_ZONE("decode image");
+        ifstream file(loader->files[i], ios::binary);
+        string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        loader->hashes[i] = hash_bytes(bytes);
+        loader->ok[i] = !bytes.empty() && loader->images[i].loadFromMemory(bytes.data(), bytes.size());
 
-    float victoryTimer = 0.0f;
-    bool victoryAnimation = false;
+        loader->done.fetch_add(1);
+    }
+}
 
-    bool isJumping = false;
-    bool up_collide = false;
-    bool left_collide = false;
-    bool right_collide = false;
+void start_asset_loader(AssetLoader &loader, const vector<string> &files, int threadCount)
+{
+    loader.files = files;
+    loader.images.resize(files.size());
+    loader.ok.assign(files.size(), 0);
+    loader.hashes.assign(files.size(), 0);
+    for (int t = 0; t < max(1, threadCount); t++)
+        loader.workers.push_back(thread(asset_worker, &loader));
+}
 
-    Texture PlayerTextureRight;
-    Texture PlayerTextureLeft;
-    Texture PlayerTextureUp;
-    Texture PlayerTextureDown;
-    Sprite PlayerSprite;
-    Texture PlayerTextureJumpRight;
-    Texture PlayerTextureJumpLeft;
-    Texture oneWayTexture;
-    Sprite oneWaySprite;
+// Joins the workers and reports anything that failed to decode
+void finish_asset_loader(AssetLoader &loader)
+{
+    for (thread &worker : loader.workers)
+        worker.join();
+    loader.workers.clear();
 
-    // Genova Data
-    Texture genovaLeftTex;
-    Texture genovaRightTex;
-    Sprite genovaSpr;
+    for (int i = 0; i < (int)loader.files.size(); i++)
+        if (!loader.ok[i])
+            cout << "Failed to load " << loader.files[i] << endl;
+}
 
-    bool genovaGoingRight = true;
-    float genovaSpeed = 1.5f;
-    bool genovaIsAttacking = false;
-    int genovaAttackFrame = 0;
-    int fireballCooldown = 0;
-    bool fireballSpawned = false;
-    genovaSpr.setScale(1.8, 1.8);
-    genovaLeftTex.loadFromFile("Data/Genova/genova_left.png");
-    genovaRightTex.loadFromFile("Data/Genova/genova_right.png");
+void print_cache_stats(const ResourceCache &cache)
+{
+    cout << "texture cache: " << cache.hits << " hits, " << cache.sharedHits << " shared-content hits, "
+         << cache.misses << " misses (" << cache.textures.size() << " textures decoded)" << endl;
+}
 
-    // Start facing right
-    genovaSpr.setTexture(genovaRightTex);
+void loadLevelAssets(const LevelData &ld, ResourceCache &cache, Sprite &bgSprite, const TextureAtlas &atlas, AtlasFrame tileFrames[])
+{
+    TRACE_ZONE("loadLevelAssets");
+    bgSprite.setTexture(*get_texture(cache, ld.background), true);
+    bgSprite.setPosition(0, 0);
 
-    // fire ball
+    for (int k = 0; k < TILE_KINDS; k++)
+        tileFrames[k] = ld.tileset[k].empty() ? AtlasFrame() : atlas_frame(atlas, ld.tileset[k]);
+}
 
-    bool fireballActive = false;
-    float fireballX = 0;
-    float fireballY = 0;
-    float fireballSpeed = 4.0f;
-    bool fireballRight = true;
-
-    Texture fire_tex[4];   // for vacuum
-    Sprite fire_sprite[4]; // for vacuum
-
-    //Enemy spawn
-    const int MAX_ENEMIES = 10;
-    int enemyTypes[MAX_ENEMIES];
-    float enemyX[MAX_ENEMIES];
-    float enemyY[MAX_ENEMIES];
-    float enemyVelocityY[MAX_ENEMIES];
-   // per-enemy speed (used for genova movement so one Genova's attack doesn't stop others)
-    float enemySpeedArr[MAX_ENEMIES];
-    // per-enemy jump cooldown (frames until next allowed jump)
-    float enemyJumpCooldownArr[MAX_ENEMIES];
-    bool enemyGoingRight[MAX_ENEMIES];
-    bool enemyDisappeared[MAX_ENEMIES];
-    bool enemySucked[MAX_ENEMIES];
-    bool enemyThrown[MAX_ENEMIES];
-    float enemyThrowVelocityX[MAX_ENEMIES];
-    float enemyThrowVelocityY[MAX_ENEMIES];
-    // per-enemy short walk timer so skeletons walk a bit before attempting to jump
-    float enemyWalkTimerArr[MAX_ENEMIES];
-    // per-enemy previous position and stuck-frame counter to detect stuck enemies
-    float enemyPrevX[MAX_ENEMIES];
-    float enemyPrevY[MAX_ENEMIES];
-    int enemyStuckFrames[MAX_ENEMIES];
-    int activeEnemyCount = 0;
-    // Per-enemy Genova attack / fireball state
-    bool genovaIsAttackingArr[MAX_ENEMIES];
-    int genovaAttackFrameArr[MAX_ENEMIES];
-    bool fireballActiveArr[MAX_ENEMIES];
-    float fireballXArr[MAX_ENEMIES];
-    float fireballYArr[MAX_ENEMIES];
-    bool fireballRightArr[MAX_ENEMIES];
-    int fireballCooldownArr[MAX_ENEMIES];
-    bool fireballSpawnedArr[MAX_ENEMIES];
-    bool fireballHitArr[MAX_ENEMIES];
-
-    for (int i = 0; i < MAX_ENEMIES; i++)
-    {
-        enemyTypes[i] = i % 4; // Cycle through 0,1,2,3
-        // by default make all slots active
-        enemyDisappeared[i] = false;
-        enemySucked[i] = false;
-        enemySucked[i] = false;
-        enemyThrown[i] = false;
-        enemyVelocityY[i] = 0;
-        enemyGoingRight[i] = true;
-        enemyThrowVelocityX[i] = 0;
-        enemyThrowVelocityY[i] = 0;
-        enemyWalkTimerArr[i] = 0.0f;
-        enemySpeedArr[i] = 1.5f; // default speed for moving enemies (Genova uses this)
-        enemyJumpCooldownArr[i] = 0;
-        // Make skeleton at index 1 less likely to jump immediately (reduce glitching)
-        if (i == 1)
-        {
-            enemyJumpCooldownArr[i] = 1.2f; // 1.2s cooldown before first allowed jump
-            enemyWalkTimerArr[i] = 0.3f;    // require ~0.3s walk before jump
-        }
-        genovaIsAttackingArr[i] = false;
-        genovaAttackFrameArr[i] = 0;
-        fireballActiveArr[i] = false;
-        fireballXArr[i] = 0;
-        fireballYArr[i] = 0;
-        fireballRightArr[i] = true;
-        fireballCooldownArr[i] = 0;
-        fireballSpawnedArr[i] = false;
-        fireballHitArr[i] = false;
-
-        // Hardcoded spawn positions (col,row) for each enemy slot.
-        // Spread skeletons: index 1 = top, index 5 = right, index 9 = bottom
-        const int defaultSpawnCols[MAX_ENEMIES] = {3, 2, 10, 14, 9, 16, 7, 12, 15, 9};
-        const int defaultSpawnRows[MAX_ENEMIES] = {6, 3, 9, 3, 11, 12, 7, 6, 8, 12};
-
-        int spawnCol = defaultSpawnCols[i];
-        int spawnRow = defaultSpawnRows[i];
-        enemyX[i] = spawnCol * cell_size;
-        enemyY[i] = spawnRow * cell_size;
-        // initialize prev pos and stuck counter
-        enemyPrevX[i] = enemyX[i];
-        enemyPrevY[i] = enemyY[i];
-        enemyStuckFrames[i] = 0;
-        // (No level validation here because `lvl` is allocated later.)
-    }
+// Player pose picked by the simulation, the renderer maps it to a texture
+const int POSE_RIGHT = 0;
+const int POSE_LEFT = 1;
+const int POSE_UP = 2;
+const int POSE_DOWN = 3;
+const int POSE_JUMP_RIGHT = 4;
+const int POSE_JUMP_LEFT = 5;
 
-    for (int i = 0; i < 4; i++)
+// Buttons held during one simulation step
+struct GameInput
+{
+    bool movingLeft = false;
+    bool movingRight = false;
+    bool pressingJump = false;
+    bool pressingUp = false;
+    bool pressingDown = false;
+    bool vacuum = false;
+    bool bulkThrow = false;
+    bool throwKey = false; // E, edge-triggered inside stepGame
+};
+
+// Per-enemy state that only some code paths touch: throw velocity, jump and
+// stuck bookkeeping, and the Genova attack/fireball state
+struct EnemyCold
+{
+    float throwVelocityX = 0;
+    float throwVelocityY = 0;
+    // jump cooldown (seconds until next allowed jump)
+    float jumpCooldown = 0;
+    // short walk timer so skeletons walk a bit before attempting to jump
+    float walkTimer = 0.0f;
+    // previous position and stuck-frame counter to detect stuck enemies
+    float prevX = 0;
+    float prevY = 0;
+    int stuckFrames = 0;
+    unsigned lastTick = 0; // tick of its last AI update, see enemy_steps
+
+    int genovaAttackFrame = 0;
+    int fireballCooldown = 0;     // frames until this Genova may shoot again
+    bool genovaIsAttacking = false;
+    bool fireballSpawned = false; // already shot during the current attack
+    // Save states copy this struct byte for byte, so no compiler padding:
+    // uninitialised padding would make identical states save differently
+    unsigned char pad[2] = {};
+};
+
+// Refers to one enemy across swap-removes. Goes stale (enemy_index returns -1)
+// once that enemy is removed, even if its slot is reused.
+struct EnemyHandle
+{
+    int slot = -1;
+    unsigned gen = 0;
+};
+
+// All enemies of the running level as parallel arrays indexed 0..enemy_count-1.
+// The hot columns are read by every per-tick loop; everything else sits in cold.
+// Removing swaps the last enemy into the hole, so indices are only valid within
+// a tick; keep an EnemyHandle to refer to an enemy for longer.
+struct EnemyStore
+{
+    vector<int> type; // 0 = Ghost, 1 = Skeleton, 2 = Invisible Man, 3 = Genova
+    vector<float> x;
+    vector<float> y;
+    vector<float> velocityY;
+    vector<float> speed; // per-enemy so one Genova's attack doesn't stop others
+    vector<char> goingRight;
+    vector<char> disappeared;
+    vector<char> sucked;
+    vector<char> thrown;
+
+    vector<EnemyCold> cold;
+
+    vector<int> denseSlot;   // dense index -> handle slot
+    vector<int> slotDense;   // handle slot -> dense index, -1 when free
+    vector<unsigned> slotGen;
+    vector<int> freeSlots;
+};
+
+int enemy_count(const EnemyStore &en)
+{
+    return (int)en.x.size();
+}
+
+void enemy_clear(EnemyStore &en)
+{
+    en.type.clear();
+    en.x.clear();
+    en.y.clear();
+    en.velocityY.clear();
+    en.speed.clear();
+    en.goingRight.clear();
+    en.disappeared.clear();
+    en.sucked.clear();
+    en.thrown.clear();
+    en.cold.clear();
+    en.denseSlot.clear();
+
+    // every live handle goes stale
+    en.freeSlots.clear();
+    for (int s = (int)en.slotDense.size() - 1; s >= 0; s--)
     {
-        string filename = "Data/Genova/fireball/" + to_string(i + 1) + ".png";
-        fire_tex[i].loadFromFile(filename);
+        if (en.slotDense[s] >= 0)
+            en.slotGen[s]++;
+        en.slotDense[s] = -1;
+        en.freeSlots.push_back(s);
     }
+}
 
-    for (int i = 0; i < 4; i++)
+EnemyHandle enemy_add(EnemyStore &en, int type, float x, float y)
+{
+    int i = enemy_count(en);
+    en.type.push_back(type);
+    en.x.push_back(x);
+    en.y.push_back(y);
+    en.velocityY.push_back(0);
+    en.speed.push_back(1.5f); // default speed for moving enemies (Genova uses this)
+    en.goingRight.push_back(true);
+    en.disappeared.push_back(false);
+    en.sucked.push_back(false);
+    en.thrown.push_back(false);
+
+    EnemyCold c;
+    c.prevX = x;
+    c.prevY = y;
+    en.cold.push_back(c);
+
+    int slot;
+    if (!en.freeSlots.empty())
     {
-
-        fire_sprite[i].setTexture(fire_tex[i]);
-        fire_sprite[i].setPosition(enemyX[1], enemyY[1]);
-        fire_sprite[i].setPosition(enemyX[5], enemyY[5]);
-        fire_sprite[i].setScale(1.8, 1.8);
+        slot = en.freeSlots.back();
+        en.freeSlots.pop_back();
+    }
+    else
+    {
+        slot = (int)en.slotDense.size();
+        en.slotDense.push_back(-1);
+        en.slotGen.push_back(0);
     }
+    en.slotDense[slot] = i;
+    en.denseSlot.push_back(slot);
 
-    Texture genova_tex[6]; // for genova attack
-    Sprite genova_sprite[6];
+    EnemyHandle h;
+    h.slot = slot;
+    h.gen = en.slotGen[slot];
+    return h;
+}
 
-    for (int i = 0; i < 6; i++)
+// Swap-remove: the last enemy moves into index i
+void enemy_remove(EnemyStore &en, int i)
+{
+    int last = enemy_count(en) - 1;
+    int slot = en.denseSlot[i];
+
+    if (i != last)
     {
-        string filename = "Data/Genova/Genova_throw/" + to_string(i + 1) + ".png";
-        genova_tex[i].loadFromFile(filename);
+        en.type[i] = en.type[last];
+        en.x[i] = en.x[last];
+        en.y[i] = en.y[last];
+        en.velocityY[i] = en.velocityY[last];
+        en.speed[i] = en.speed[last];
+        en.goingRight[i] = en.goingRight[last];
+        en.disappeared[i] = en.disappeared[last];
+        en.sucked[i] = en.sucked[last];
+        en.thrown[i] = en.thrown[last];
+        en.cold[i] = en.cold[last];
+        en.denseSlot[i] = en.denseSlot[last];
+        en.slotDense[en.denseSlot[i]] = i;
     }
 
-    for (int i = 0; i < 6; i++)
-    {
+    en.type.pop_back();
+    en.x.pop_back();
+    en.y.pop_back();
+    en.velocityY.pop_back();
+    en.speed.pop_back();
+    en.goingRight.pop_back();
+    en.disappeared.pop_back();
+    en.sucked.pop_back();
+    en.thrown.pop_back();
+    en.cold.pop_back();
+    en.denseSlot.pop_back();
+
+    en.slotDense[slot] = -1;
+    en.slotGen[slot]++;
+    en.freeSlots.push_back(slot);
+}
 
-        genova_sprite[i].setTexture(genova_tex[i]);
-        genova_sprite[i].setPosition(enemyX[1], enemyY[1]);
-        genova_sprite[i].setPosition(enemyX[5], enemyY[5]);
-        genova_sprite[i].setScale(1.8, 1.8);
+EnemyHandle enemy_handle(const EnemyStore &en, int i)
+{
+    EnemyHandle h;
+    h.slot = en.denseSlot[i];
+    h.gen = en.slotGen[h.slot];
+    return h;
+}
+
+// Current index of the enemy, or -1 if it has been removed
+int enemy_index(const EnemyStore &en, EnemyHandle h)
+{
+    if (h.slot < 0 || h.slot >= (int)en.slotDense.size() || en.slotGen[h.slot] != h.gen)
+        return -1;
+    return en.slotDense[h.slot];
+}
+
+// Live enemies bucketed by the tile cell holding their top-left corner, so
+// proximity checks only visit the cells a query box touches. Buckets hold
+// handle slots, which survive swap-removes. Positions outside the map are
+// clamped into the border cells.
+struct EnemyGrid
+{
+    int cellSize = 64;
+    int rows = 0;
+    int cols = 0;
+    vector<vector<int>> buckets;
+    vector<int> slotCell; // bucket of each handle slot, -1 when not in the grid
+    vector<int> slotPos;  // index inside that bucket
+};
+
+void grid_init(EnemyGrid &g, int rows, int cols, int cellSize)
+{
+    g.cellSize = cellSize;
+    g.rows = rows;
+    g.cols = cols;
+    g.buckets.assign(rows * cols, vector<int>());
+    g.slotCell.clear();
+    g.slotPos.clear();
+}
+
+void grid_clear(EnemyGrid &g)
+{
+    for (int b = 0; b < (int)g.buckets.size(); b++)
+        g.buckets[b].clear();
+    fill(g.slotCell.begin(), g.slotCell.end(), -1);
+}
+
+int grid_col(const EnemyGrid &g, float x)
+{
+    int c = (int)floor(x / g.cellSize);
+    return max(0, min(c, g.cols - 1));
+}
+
+int grid_row(const EnemyGrid &g, float y)
+{
+    int r = (int)floor(y / g.cellSize);
+    return max(0, min(r, g.rows - 1));
+}
+
+// Move a slot to another bucket, -1 takes it out of the grid
+void grid_set_cell(EnemyGrid &g, int slot, int cell)
+{
+    if (slot >= (int)g.slotCell.size())
+    {
+        g.slotCell.resize(slot + 1, -1);
+        g.slotPos.resize(slot + 1, 0);
     }
 
-    // Ghost data
-    Texture ghostLeftTex;
-    Texture ghostRightTex;
-    Sprite ghostSpr;
+    int old = g.slotCell[slot];
+    if (old == cell)
+        return;
 
-    bool goingRight = true;
-    float ghostSpeed = 1.8f;
+    if (old >= 0)
+    {
+        vector<int> &b = g.buckets[old];
+        int pos = g.slotPos[slot];
+        b[pos] = b.back();
+        g.slotPos[b[pos]] = pos;
+        b.pop_back();
+    }
+    if (cell >= 0)
+    {
+        g.slotPos[slot] = (int)g.buckets[cell].size();
+        g.buckets[cell].push_back(slot);
+    }
+    g.slotCell[slot] = cell;
+}
 
-    ghostSpr.setScale(1.8, 1.8);
-    ghostLeftTex.loadFromFile("Data/Ghost/ghost_left.png");
-    ghostRightTex.loadFromFile("Data/Ghost/ghost_right.png");
+// Re-bucket enemy i after it moved or changed state; hidden enemies leave the grid
+void grid_update(EnemyGrid &g, const EnemyStore &en, int i)
+{
+    int cell = -1;
+    if (!en.disappeared[i] && !en.sucked[i])
+        cell = grid_row(g, en.y[i]) * g.cols + grid_col(g, en.x[i]);
+    grid_set_cell(g, en.denseSlot[i], cell);
+}
 
-    // Start facing right
-    ghostSpr.setTexture(ghostRightTex);
+void grid_remove(EnemyGrid &g, const EnemyStore &en, int i)
+{
+    grid_set_cell(g, en.denseSlot[i], -1);
+}
 
-    // skeleton data
-    Texture skelLeftTex;
-    Texture skelRightTex;
-    Sprite skelSpr;
+// Indices (ascending) of the enemies whose top-left corner can lie inside
+// [x0, x1] x [y0, y1]. Callers still apply their exact range test.
+void grid_query_box(const EnemyGrid &g, const EnemyStore &en, float x0, float y0, float x1, float y1, vector<int> &out)
+{
+    out.clear();
+    int c0 = grid_col(g, x0);
+    int c1 = grid_col(g, x1);
+    int r0 = grid_row(g, y0);
+    int r1 = grid_row(g, y1);
 
-    float skelX = 500;
-    float skelY = 765;
-    bool skelgoingRight = true;
-    float skelSpeed = 2.0f;
+    for (int r = r0; r <= r1; r++)
+    {
+        for (int c = c0; c <= c1; c++)
+        {
+            const vector<int> &b = g.buckets[r * g.cols + c];
+            for (int k = 0; k < (int)b.size(); k++)
+                out.push_back(en.slotDense[b[k]]);
+        }
+    }
+    sort(out.begin(), out.end());
+}
 
-    skelSpr.setScale(1.8, 1.8);
-    skelLeftTex.loadFromFile("Data/Skeleton/skeleton_left.png");
-    skelRightTex.loadFromFile("Data/Skeleton/skeleton_right.png");
+// Indices (ascending) of the enemies whose top-left corner is within range of
+// (x, y) and at most the half angle off the unit direction (dirX, dirY); the
+// half angle is given as its cosine, 0 being the half disc on that side.
+// Unlike grid_query_box the test here is exact.
+void grid_query_cone(const EnemyGrid &g, const EnemyStore &en, float x, float y, float dirX, float dirY, float range,
+                     float cosHalfAngle, vector<int> &out)
+{
+    // Only the cells of the disc's bounding box on the facing side, when the
+    // direction is along an axis and the cone is no wider than a half disc
+    float x0 = x - range;
+    float x1 = x + range;
+    float y0 = y - range;
+    float y1 = y + range;
+    if (cosHalfAngle >= 0 && dirY == 0)
+        (dirX > 0 ? x0 : x1) = x;
+    if (cosHalfAngle >= 0 && dirX == 0)
+        (dirY > 0 ? y0 : y1) = y;
+    grid_query_box(g, en, x0, y0, x1, y1, out);
+
+    int kept = 0;
+    for (int k = 0; k < (int)out.size(); k++)
+    {
+        int i = out[k];
+        float dx = en.x[i] - x;
+        float dy = en.y[i] - y;
+        float dist2 = dx * dx + dy * dy;
+        if (dist2 <= range * range && dx * dirX + dy * dirY >= cosHalfAngle * sqrt(dist2))
+            out[kept++] = i;
+    }
+    out.resize(kept);
+}
 
-    // Start facing right
-    skelSpr.setTexture(ghostRightTex);
+// Seconds per stepGame call. The rate is fixed: speeds, gravity, cooldown
+// frames and animation counters are all tuned per tick at 60 Hz.
+const float TICK_DT = 1.0f / 60.0f;
 
-    // invisible man data
-    Texture invisLeftTex;
-    Texture invisRightTex;
-    Sprite invisSpr;
+// Everything the simulation reads and writes. Nothing in here touches SFML
+// graphics, so it can be stepped without a window.
+struct GameState
+{
+    int cell_size = 64;
+    int height = 14;
+    int width = 18;
+    TileMap lvl;
 
-    bool invisGoingRight = true;
-    float invisSpeed = 2.0f;
+    int gameState = 0; // 0 = menu, 1 = playing
+    int selectedLevel = 1;
+    bool levelChanged = false; // set by startLevel and load_game_state so the renderer reloads level assets
 
-    invisSpr.setScale(1.8, 1.8);
-    invisLeftTex.loadFromFile("Data/invisible/iman_left.png");
-    invisRightTex.loadFromFile("Data/invisible/iman_right.png");
+    GameInput input; // input of the last step, the renderer uses it for animations
 
-    // Start facing right
-    invisSpr.setTexture(ghostRightTex);
+    // Simulation RNG state and the seed the run started from
+    unsigned seed = 1;
+    unsigned rng = 1;
+    unsigned tick = 0; // stepGame calls since the run started
 
-    int walkframe = 0;
-    int vacuumframe = 0;
-    int victoryFrame = 0;
-    bool onGround = false;
+    // Enemies centred in this box run every tick, see enemy_steps
+    float nearX0 = 0;
+    float nearY0 = 0;
+    float nearX1 = 0;
+    float nearY1 = 0;
 
-    int lifeCount = 3;
+    // Seconds of game time per stepGame call, always TICK_DT. Timers and
+    // cooldowns count down by this; recordings and save states carry it.
+    float tickDt = TICK_DT;
 
-    float offset_x = 0;
+    float player_x = 500;
+    float player_y = 150;
     float offset_y = 0;
     float velocityY = 0;
+    bool onGround = false;
+    bool facingRight = true;
+    int playerPose = POSE_RIGHT;
+    int PlayerHeight = 64;
+    int PlayerWidth = 68;
 
+    float speed = 5;
+    float dropTimer = 0.0f;
+    float dropDuration = 0.15f;
+    float jumpStrength = -17;
+    float gravity = 1;
     float terminal_Velocity = 20;
     float dropCooldown = 0.0f;
     float damageCooldown = 0.0f;
+    bool dropDown = false;
+    int lifeCount = 3;
 
-    int PlayerHeight = 64;
-    int PlayerWidth = 68;
+    float victoryTimer = 0.0f;
+    bool victoryAnimation = false;
 
-    bool up_button = false;
+    int walkframe = 0;
+    int vacuumframe = 0;
+    int victoryFrame = 0;
 
-    char top_left = '\0';
-    char top_right = '\0';
-    char top_mid = '\0';
+    bool singleThrowPressed = false;
+    float throwVelocityX = 15.0f;
+    float throwVelocityY = 15.0f;
 
-    char left_mid = '\0';
-    char right_mid = '\0';
+    EnemyHandle backpack[backpackMax]; // sucked enemies, thrown back out last-in first-out
+    int backCount = 0;
+    int backpackCap = 3; // set from the level file
 
-    char bottom_left = '\0';
-    char bottom_right = '\0';
-    char bottom_mid = '\0';
+    float ghostSpeed = 1.8f;
+    float invisSpeed = 2.0f;
+    float fireballSpeed = 4.0f;
 
-    char bottom_left_down = '\0';
-    char bottom_right_down = '\0';
-    char bottom_mid_down = '\0';
+    // invisible man (shared by every invisible man slot)
+    bool isInvisible = false;
+    float invisibleTimer = 0;
+    float invisibleDuration = 0;
+    bool Disappearing = 0;
+    int invisDisappearFrame = 0;
+    float nextDisappearTime = 0;
+    int invisFrameCounter = 0;
+
+    EnemyStore enemies;
+    EnemyGrid enemyGrid;
+    ProjectilePool projectiles;
+    bool fireballHit = false; // a projectile reached the player this tick
+    vector<int> nearbyEnemies; // scratch for grid queries, reused every tick
+    vector<int> enemySteps;    // scratch: ticks each enemy advances this tick, see enemy_steps
+};
+
+void initGameState(GameState &gs, unsigned seed)
+{
+    init_tile_flag_table();
 
-    char top_right_up = '\0';
-    char top_mid_up = '\0';
-    char top_left_up = '\0';
+    gs.seed = seed;
+    gs.rng = seed != 0 ? seed : 1; // xorshift never leaves 0
 
-    bool dropDown = false;
-    bool facingRight = true;
+    gs.nextDisappearTime = sim_rand(gs.rng) % 1000;
+    projectile_init(gs.projectiles, projectileReserve);
+    // (Enemies are spawned by startLevel once the level is built.)
+}
 
-    float throwVelocityX = 15.0f;
-    float throwVelocityY = 15.0f;
+// The tile map of a level, bitboards and spawn index included. It only
+// depends on the level file, play never changes it.
+void build_level_tiles(TileMap &lvl, const LevelData &ld)
+{
+    // Same size as the last level: keep the buffers
+    if (ld.width != lvl.width || ld.height != lvl.height)
+        init_tile_map(lvl, ld.height, ld.width);
+    else
+        clear_tile_map(lvl);
 
-    bool ghostDisappear = false;
-    bool skelDisappear = false;
-    bool invisDisappear = false;
-    bool genovaDisappear = false;
-
-    bool ghostThrown = false;
-    bool skelThrown = false;
-    bool invisThrown = false;
-    bool genovaThrown = false;
-
-    float ghostThrowVelocityX = 0.0f;
-    float skelThrowVelocityX = 0.0f;
-    float invisThrowVelocityX = 0.0f;
-    float genovaThrowVelocityX = 0.0f;
-
-    float ghostThrowVelocityY = 0.0f;
-    float skelThrowVelocityY = 0.0f;
-    float invisThrowVelocityY = 0.0f;
-    float genovaThrowVelocityY = 0.0f;
-
-    bool ghostSucked = false;
-    bool skelSucked = false;
-    bool invisSucked = false;
-    bool genovaSucked = false;
-
-    if (!PlayerTextureJumpRight.loadFromFile("Data/jump_right.png"))
-        cout << "Failed to load jump_right.png" << endl;
-    if (!PlayerTextureJumpLeft.loadFromFile("Data/jump_left.png"))
-        cout << "Failed to load jump_left.png" << endl;
-    if (!PlayerTextureRight.loadFromFile("Data/player_right.png"))
-        cout << "Failed to load player_right.png" << endl;
-    if (!PlayerTextureLeft.loadFromFile("Data/player_left.png"))
-        cout << "Failed to load player_left.png" << endl;
-    if (!PlayerTextureUp.loadFromFile("Data/player_up.png"))
-        cout << "Failed to load player_up.png" << endl;
-    if (!PlayerTextureDown.loadFromFile("Data/player_down.png"))
-
-    PlayerSprite.setTexture(PlayerTextureRight);
-    PlayerSprite.setScale(2, 2);
-    PlayerSprite.setPosition(player_x, player_y);
+    for (int r = 0; r < ld.height; r++)
+    {
+        for (int c = 0; c < ld.width; c++)
+        {
+            char t = ld.tiles[r * ld.width + c];
+            if (t != ' ')
+                set_tile(lvl, r, c, t);
+        }
+    }
+    build_spawn_index(lvl);
+}
+
+void startLevel(GameState &gs)
+{
+    TRACE_ZONE("startLevel");
+    gs.selectedLevel = max(1, min(gs.selectedLevel, (int)levelTable.size()));
+    const LevelData &ld = levelTable[gs.selectedLevel - 1];
 
-    lvl = new char *[height];
-    for (int i = 0; i < height; i += 1)
+    if (ld.width != gs.lvl.width || ld.height != gs.lvl.height)
+    {
+        gs.width = ld.width;
+        gs.height = ld.height;
+        grid_init(gs.enemyGrid, gs.height, gs.width, gs.cell_size);
+    }
+    build_level_tiles(gs.lvl, ld);
+
+    gs.player_x = ld.playerX;
+    gs.player_y = ld.playerY;
+    gs.backpackCap = ld.backpack;
+    gs.backCount = 0;
+
+    gs.lifeCount = 3;
+    gs.velocityY = 0;
+    gs.onGround = false;
+    gs.damageCooldown = 0.0f;
+    gs.dropCooldown = 0.0f;
+
+    enemy_clear(gs.enemies);
+    grid_clear(gs.enemyGrid);
+    projectile_clear(gs.projectiles);
+    for (const LevelSpawn &s : ld.spawns)
     {
-        lvl[i] = new char[width];
-        for (int j = 0; j < width; j++)
-            lvl[i][j] = ' ';
+        int spawnCol = s.col;
+        int spawnRow = s.row;
+        findValidSpawn(gs.lvl, spawnRow, spawnCol, s.type);
+
+        EnemyHandle h = enemy_add(gs.enemies, s.type, spawnCol * gs.cell_size, spawnRow * gs.cell_size);
+        int i = enemy_index(gs.enemies, h);
+        grid_update(gs.enemyGrid, gs.enemies, i);
+        gs.enemies.cold[i].jumpCooldown = s.jumpCooldown;
+        gs.enemies.cold[i].walkTimer = s.walkTimer;
+        gs.enemies.cold[i].lastTick = gs.tick;
     }
 
-    Event ev;
+    // Renderer reloads the level textures and restarts the music
+    gs.levelChanged = true;
+}
 
-    bool spacePressed = false;
-    bool escapePressed = false;
+// Off-screen enemies, more than one chunk from the player's chunk, only get an
+// AI update every FAR_TICK_DIVISOR ticks, staggered by handle slot. That
+// update catches them up on the ticks in between, so they don't move or count
+// down any slower than near ones.
+const int FAR_TICK_DIVISOR = 4;
 
-    Font font;
-    bool fontLoaded = font.loadFromFile("Data/arialbd.ttf");
-    if (!fontLoaded)
-        cout << "Failed to load font" << endl;
+// Pixel box of the 3x3 chunks around the player's, once per tick
+void update_near_box(GameState &gs)
+{
+    const float chunkPx = CHUNK_TILES * gs.cell_size;
+    float col = floor((gs.player_x + gs.PlayerWidth / 2) / chunkPx);
+    float row = floor((gs.player_y + gs.PlayerHeight / 2) / chunkPx);
+    gs.nearX0 = (col - 1) * chunkPx;
+    gs.nearX1 = (col + 2) * chunkPx;
+    gs.nearY0 = (row - 1) * chunkPx;
+    gs.nearY1 = (row + 2) * chunkPx;
+}
 
-    Text titleText;
-    titleText.setFont(font);
-    Text level1Text;
-    level1Text.setFont(font);
-    Text level2Text;
-    level2Text.setFont(font);
-    Text instructText;
-    instructText.setFont(font);
+// How many ticks enemy i advances this tick: the ticks since its last update
+// (1 near the player, where it runs every tick), or 0 when it is far away and
+// not due. Invisible men always run every tick, their update also advances the
+// disappearing timers they share through GameState.
+int enemy_steps(GameState &gs, int i)
+{
+    EnemyCold &c = gs.enemies.cold[i];
+    if (gs.enemies.type[i] != 2)
+    {
+        float cx = gs.enemies.x[i] + 32;
+        float cy = gs.enemies.y[i] + 32;
+        bool near = cx >= gs.nearX0 && cx < gs.nearX1 && cy >= gs.nearY0 && cy < gs.nearY1;
+        if (!near && (gs.tick + gs.enemies.denseSlot[i]) % FAR_TICK_DIVISOR != 0)
+            return 0;
+    }
+    int steps = (int)max(1u, min((unsigned)FAR_TICK_DIVISOR, gs.tick - c.lastTick));
+    c.lastTick = gs.tick;
+    return steps;
+}
 
-    while (window.isOpen())
+// Camera over the level: centred on the player but kept inside the level,
+// levels smaller than the view are centred instead
+View camera_view(const GameState &gs, float viewW, float viewH)
+{
+    float levelW = gs.width * gs.cell_size;
+    float levelH = gs.height * gs.cell_size;
+    float cx = gs.player_x + gs.PlayerWidth / 2;
+    float cy = gs.player_y + gs.PlayerHeight / 2;
+    cx = levelW <= viewW ? levelW / 2 : max(viewW / 2, min(cx, levelW - viewW / 2));
+    cy = levelH <= viewH ? levelH / 2 : max(viewH / 2, min(cy, levelH - viewH / 2));
+
+    View camera(FloatRect(0, 0, viewW, viewH));
+    camera.setCenter(cx, cy);
+    return camera;
+}
+
+GameInput readKeyboardInput()
+{
+    GameInput in;
+    in.movingLeft = Keyboard::isKeyPressed(Keyboard::Left);
+    in.movingRight = Keyboard::isKeyPressed(Keyboard::Right);
+    in.pressingJump = Keyboard::isKeyPressed(Keyboard::C);
+    in.pressingUp = Keyboard::isKeyPressed(Keyboard::W);
+    in.pressingDown = Keyboard::isKeyPressed(Keyboard::S);
+    in.vacuum = Keyboard::isKeyPressed(Keyboard::Space);
+    in.bulkThrow = Keyboard::isKeyPressed(Keyboard::Q);
+    in.throwKey = Keyboard::isKeyPressed(Keyboard::E);
+    return in;
+}
+
+// Advance the game by one fixed tick of gs.tickDt seconds. No drawing, no audio, no window.
+void stepGame(GameState &gs, const GameInput &in)
+{
+    TRACE_ZONE("stepGame");
+    if (gs.gameState != 1)
+        return;
+
+    ProfScope simScope(PROF_SIM);
+    gs.tick++;
+
+    const int cell_size = gs.cell_size;
+    const TileMap &lvl = gs.lvl;
+    int &selectedLevel = gs.selectedLevel;
+    float &player_x = gs.player_x;
+    float &player_y = gs.player_y;
+    int &backCount = gs.backCount;
+    EnemyHandle *backpack = gs.backpack;
+    EnemyStore &en = gs.enemies;
+    vector<int> &enemyTypes = en.type;
+    vector<float> &enemyX = en.x;
+    vector<float> &enemyY = en.y;
+    vector<char> &enemyDisappeared = en.disappeared;
+    vector<char> &enemySucked = en.sucked;
+    vector<char> &enemyThrown = en.thrown;
+    EnemyGrid &grid = gs.enemyGrid;
+    vector<int> &nearby = gs.nearbyEnemies;
+    const int enemyCount = enemy_count(en);
+
+    gs.input = in;
+
+    float suctionSpeed = 5.0f;
+
+    // Check collision with all active enemies
+    bool activeMonsterCollision = false;
+    grid_query_box(grid, en, player_x - 32, player_y - 32, player_x + 32, player_y + 32, nearby);
+    for (int k = 0; k < (int)nearby.size(); k++)
     {
-        window.clear(Color::Black);
+        int i = nearby[k];
+        if (enemyDisappeared[i] || enemySucked[i])
+            continue;
 
-        // Handle window events in both states
-        while (window.pollEvent(ev))
+        bool xCollision = enemyX[i] >= (player_x - 32) && enemyX[i] <= (player_x + 32);
+        bool yCollision = enemyY[i] >= (player_y - 32) && enemyY[i] <= (player_y + 32);
+
+        if (xCollision && yCollision)
         {
-            if (ev.type == Event::Closed)
-                window.close();
+            activeMonsterCollision = true;
+            break;
         }
+    }
 
-        // ===== MENU SCREEN =====
-        if (gameState == 0)
-        {
-            window.draw(bgmenusprite);
+    gs.vacuumframe++;
+    if (gs.vacuumframe >= 20)
+        gs.vacuumframe = 0;
 
-           /*RectangleShape titleBox(Vector2f(600, 150));
-            titleBox.setPosition(screen_x / 2 - 300, 100);
-            titleBox.setFillColor(lightWhite);
-            window.draw(titleBox);*/
+    gs.victoryFrame++;
+    if (gs.victoryFrame >= 20)
+        gs.victoryFrame = 0;
 
-            if (fontLoaded) // code for text load and show
-            {
-                // titleText.setString("TUMBLE-POP");
-                // titleText.setCharacterSize(60);
-                // titleText.setFillColor(Color::White);
-                logoSprite.setTexture(logoTex);
-                logoSprite.setScale(0.5, 0.5);
-                window.draw(logoSprite);
-                logoSprite.setPosition(screen_x / 2 - 250, 200);
-            }
+    gs.walkframe++;
+    if (gs.walkframe >= 32)
+        gs.walkframe = 0;
 
-            RectangleShape level1Box(Vector2f(400, 80));
-            level1Box.setPosition(screen_x / 2 - 200, 350);
-            if (selectedLevel == 1)
-                level1Box.setFillColor(darkBlue);
+    bool movingLeft = in.movingLeft;
+    bool movingRight = in.movingRight;
+    bool pressingJump = in.pressingJump;
+    bool pressingUp = in.pressingUp;
+    bool pressingDown = in.pressingDown;
+    bool vacuum = in.vacuum;
+    bool bulkThrow = in.bulkThrow;
 
-            else
-                level1Box.setFillColor(Color::Green);
-            window.draw(level1Box);
+    bool singleThrow = false;
 
-            if (fontLoaded)
-            {
-                level1Text.setString("LEVEL 1");
-                level1Text.setCharacterSize(40);
-                level1Text.setFillColor(Color::Black);
-                level1Text.setPosition(level1Box.getPosition().x + 120, level1Box.getPosition().y + 15);
-                window.draw(level1Text);
-            }
+    // E press
+    if (in.throwKey && !gs.singleThrowPressed)
+    {
+        singleThrow = true;
+        gs.singleThrowPressed = true;
+    }
+    if (!in.throwKey)
+    {
+        gs.singleThrowPressed = false;
+    }
 
-            RectangleShape level2Box(Vector2f(400, 80));
-            level2Box.setPosition(screen_x / 2 - 200, 470);
-            if (selectedLevel == 2)
-                level2Box.setFillColor(darkBlue);
-            else
-                level2Box.setFillColor(Color::Green);
-            window.draw(level2Box);
+    if (!gs.onGround)
+    {
+        if (gs.facingRight)
+            gs.playerPose = POSE_JUMP_RIGHT;
+        else
+            gs.playerPose = POSE_JUMP_LEFT;
+    }
+    else if (movingLeft)
+    {
+        gs.facingRight = false;
+        gs.playerPose = POSE_LEFT;
+    }
+    else if (movingRight)
+    {
+        gs.facingRight = true;
+        gs.playerPose = POSE_RIGHT;
+    }
+    else if (pressingUp)
+    {
+        gs.facingRight = false;
+        gs.playerPose = POSE_UP;
+    }
+    else if (pressingDown)
+    {
+        gs.facingRight = false;
+        gs.playerPose = POSE_DOWN;
+    }
+    else
+    {
+        if (gs.facingRight)
+            gs.playerPose = POSE_RIGHT;
+        else
+            gs.playerPose = POSE_LEFT;
+    }
+    bool facingRight = gs.facingRight;
 
-            if (fontLoaded)
-            {
-                level2Text.setString("LEVEL 2");
-                level2Text.setCharacterSize(40);
-                level2Text.setFillColor(Color::Black);
-                level2Text.setPosition(level2Box.getPosition().x + 120, level2Box.getPosition().y + 15);
-                window.draw(level2Text);
-            }
+    {
+        ProfScope scope(PROF_PLAYER);
+        if (pressingDown && pressingJump && gs.onGround)
+            gs.dropTimer = gs.dropDuration;
+        else if (pressingJump && gs.onGround)
+            gs.velocityY = gs.jumpStrength;
 
-            if (fontLoaded)
+        if (gs.dropTimer > 0)
+            gs.dropTimer -= gs.tickDt;
+
+        gs.dropDown = gs.dropTimer > 0;
+
+        if (gs.dropCooldown > 0)
+            gs.dropCooldown -= gs.tickDt;
+
+        player_horizontal_collision(lvl, player_x, player_y, cell_size, gs.PlayerHeight, gs.PlayerWidth, gs.speed, movingLeft, movingRight, gs.victoryAnimation);
+        player_gravity(lvl, gs.offset_y, gs.velocityY, gs.onGround, gs.gravity, gs.terminal_Velocity, player_x, player_y, cell_size, gs.PlayerHeight, gs.PlayerWidth, gs.dropDown, gs.dropCooldown, gs.victoryAnimation);
+
+        // Check left, mid and right points underneath player sprite
+        // If player sprite is on slope blocks, increase player axes to give slide effect
+        // (levels without slope tiles never match)
+        if (gs.onGround)
+        {
+            int slopeGridY = (int)(player_y + gs.PlayerHeight) / cell_size;
+
+            int slopeGridXLeft = (int)(player_x) / cell_size;
+            int slopeGridXMid = (int)(player_x + gs.PlayerWidth / 2) / cell_size;
+            int slopeGridXRight = (int)(player_x + gs.PlayerWidth - 1) / cell_size;
+
+            unsigned char slopeFlags = tileFlags(lvl, slopeGridY, slopeGridXLeft) |
+                                       tileFlags(lvl, slopeGridY, slopeGridXMid) |
+                                       tileFlags(lvl, slopeGridY, slopeGridXRight);
+
+            if (slopeFlags & TILE_SLOPE_UP)
             {
-                string instruct = "UP/DOWN to Select | SPACE to Play | ESC to Exit\n\n"
-                                  "LEFT/RIGHT for Movement\nC for Jump\n"
-                                  "W/S for Up/Down Vacuum\n"
-                                  "Q for Bulk Throw\nE for Single Throw\n"
-                                  "S + C for Drop";
-                instructText.setString(instruct);
-                instructText.setCharacterSize(20);
-                instructText.setFillColor(Color::Black);
-                instructText.setPosition(screen_x / 2 - 225, 600);
-                window.draw(instructText);
+                player_x += 2.0f;
+                player_y += 2.0f;
             }
-
-            static bool upPressed = false;
-            if (Keyboard::isKeyPressed(Keyboard::Up) && !upPressed)
+            else if (slopeFlags & TILE_SLOPE_DOWN)
             {
-                if (selectedLevel == 2)
-                    selectedLevel = 1;
-                upPressed = true;
+                player_x -= 2.0f;
+                player_y += 2.0f;
             }
-            if (!Keyboard::isKeyPressed(Keyboard::Up))
-                upPressed = false;
-
-            static bool downPressed = false;
-            if (Keyboard::isKeyPressed(Keyboard::Down) && !downPressed)
-            {
-                if (selectedLevel == 1)
-                    selectedLevel = 2;
-                downPressed = true;
-            }
-            if (!Keyboard::isKeyPressed(Keyboard::Down))
-                downPressed = false;
+        }
+    }
 
-            if (Keyboard::isKeyPressed(Keyboard::Escape) && !escapePressed)
-            {
-                window.close();
-                escapePressed = true;
+    {
+        ProfScope scope(PROF_ENEMIES);
+        update_near_box(gs);
+        vector<int> &steps = gs.enemySteps;
+        steps.assign(enemyCount, 0);
+        for (int i = 0; i < enemyCount; i++)
+        {
+            if (enemyDisappeared[i] || enemySucked[i])
+                continue;
+            // thrown enemies skip the AI, but the stuck and Genova passes use their steps
+            steps[i] = enemy_steps(gs, i);
+            if (steps[i] == 0 || enemyThrown[i])
+                continue;
+
+            bool goingRight = en.goingRight[i];
+            EnemyCold &c = en.cold[i];
+
+            if (enemyTypes[i] == 0)
+            { // Ghost
+                updateGhost(lvl, enemyX[i], enemyY[i], goingRight,
+                            gs.ghostSpeed, en.velocityY[i], cell_size, steps[i]);
+            }
+            else if (enemyTypes[i] == 1)
+            { // Skeleton
+                updateskel(lvl, enemyX[i], enemyY[i], goingRight,
+                           en.speed[i], en.velocityY[i], cell_size,
+                           player_x, player_y, c.jumpCooldown, c.walkTimer, gs.tickDt, gs.rng, steps[i]);
+            }
+            else if (enemyTypes[i] == 2)
+            { // Invisible Man
+                updateinvisibleman(en.velocityY[i], lvl, cell_size, player_y,
+                                   player_x, enemyX[i], enemyY[i], goingRight,
+                                   gs.invisSpeed, gs.isInvisible, gs.invisibleTimer, gs.invisibleDuration,
+                                   gs.nextDisappearTime, gs.Disappearing, gs.invisDisappearFrame, gs.invisFrameCounter, gs.rng);
+            }
+            else if (enemyTypes[i] == 3)
+            { // Genova
+                // Use per-enemy attack state so Genovas don't interfere
+                updateGenova(lvl, cell_size, player_x, player_y, enemyX[i], enemyY[i],
+                             goingRight, en.speed[i],
+                             c.genovaIsAttacking, c.genovaAttackFrame, c.fireballCooldown, steps[i]);
             }
-            if (!Keyboard::isKeyPressed(Keyboard::Escape))
-                escapePressed = false;
 
-            if (Keyboard::isKeyPressed(Keyboard::Space) && !spacePressed)
+            en.goingRight[i] = goingRight;
+            grid_update(grid, en, i);
+        }
+    }
+
+    // After updates, ensure no enemy is stuck inside solid tiles; if so, relocate them
+    {
+        ProfScope scope(PROF_STUCK);
+        for (int i = 0; i < enemyCount; ++i)
+        {
+            if (enemyDisappeared[i] || enemySucked[i])
+                continue;
+            if (overlapsSolid(lvl, enemyX[i], enemyY[i], 64, 64, cell_size))
             {
-                gameState = 1;
-                backCountLevel1 = 0;
-                backCountLevel2 = 0;
-                startLevel(selectedLevel, height, width, lifeCount, player_x, player_y, velocityY, onGround, damageCooldown, dropCooldown,
-                        lvl, bgTex, bgSprite, blockTexture, blockSprite, oneWayTexture, oneWaySprite,
-                        slopeTexture, slopeSprite, slopeBotTexture, slopeBotSprite, spacePressed, lvlMusic,
-                        enemyTypes, enemyX, enemyY, enemyDisappeared, enemySucked, enemyThrown, 
-                        enemyVelocityY, enemyGoingRight, enemyThrowVelocityX, enemyThrowVelocityY, 
-                        MAX_ENEMIES, cell_size);
+                // Avoid relocating enemies that are currently moving upward (jumping),
+                // since they may temporarily intersect tiles while ascending.
+                if (en.velocityY[i] < 0.0f)
+                    continue;
+                int spawnCol = (int)(enemyX[i] / cell_size);
+                int spawnRow = (int)(enemyY[i] / cell_size);
+                findValidSpawn(lvl, spawnRow, spawnCol, enemyTypes[i]);
+                enemyX[i] = spawnCol * cell_size;
+                enemyY[i] = spawnRow * cell_size;
+                grid_update(grid, en, i);
             }
-            if (!Keyboard::isKeyPressed(Keyboard::Space))
-                spacePressed = false;
         }
 
-        // ===== PLAYING SCREEN =====
-        else if (gameState == 1)
+        // Stuck detection: if an enemy hasn't moved for a while, relocate (especially ghosts).
+        // Its own pass, once per tick, so the counter really counts frames.
+        for (int i = 0; i < enemyCount; ++i)
         {
-            if (Keyboard::isKeyPressed(Keyboard::Escape) && !escapePressed)
+            if (enemyDisappeared[i] || enemySucked[i])
+                continue;
+            // an off-screen enemy standing still between its updates isn't stuck
+            int steps = gs.enemySteps[i];
+            if (steps == 0)
+                continue;
+            float dx = fabs(enemyX[i] - en.cold[i].prevX);
+            float dy = fabs(enemyY[i] - en.cold[i].prevY);
+            if (dx < 1.0f && dy < 1.0f)
             {
-                gameState = 0;
-                lvlMusic.stop();
-                escapePressed = true;
+                en.cold[i].stuckFrames += steps;
             }
-            if (!Keyboard::isKeyPressed(Keyboard::Escape))
-                escapePressed = false;
-
-            float suctionSpeed = 5.0f;
-            int heartDistance = 64;
-            int heartPosition = -54;
-
-            // Create proximity bools for each enemy
-            bool ghostActive = !ghostDisappear && !ghostSucked;
-            bool skelActive = !skelDisappear && !skelSucked;
-            bool invisActive = !invisDisappear && !invisSucked;
-            bool genovaActive = !genovaDisappear && !genovaSucked;
-            // Check collision with all active enemies
-            bool activeMonsterCollision = false;
-            for (int i = 0; i < MAX_ENEMIES; i++)
+            else
             {
-                if (enemyDisappeared[i] || enemySucked[i])
-                    continue;
+                en.cold[i].stuckFrames = 0;
+            }
 
-                bool xCollision = enemyX[i] >= (player_x - 32) && enemyX[i] <= (player_x + 32);
-                bool yCollision = enemyY[i] >= (player_y - 32) && enemyY[i] <= (player_y + 32);
+            // update previous position for next frame
+            en.cold[i].prevX = enemyX[i];
+            en.cold[i].prevY = enemyY[i];
 
-                if (xCollision && yCollision)
+            // If stuck for >30 frames (~0.5s), relocate ghosts to a valid nearby spawn
+            if (en.cold[i].stuckFrames > 30)
+            {
+                if (enemyTypes[i] == 0)
                 {
-                    activeMonsterCollision = true;
-                    break;
+                    int sc = (int)(enemyX[i] / cell_size);
+                    int sr = (int)(enemyY[i] / cell_size);
+                    findValidSpawn(lvl, sr, sc, enemyTypes[i]);
+                    enemyX[i] = sc * cell_size;
+                    enemyY[i] = sr * cell_size;
+                    grid_update(grid, en, i);
                 }
+                en.cold[i].stuckFrames = 0;
             }
+        }
+    }
 
-            bool suctionRangeGhostX;
-            bool suctionRangeSkelX;
-            bool suctionRangeInvisX;
-            bool suctionRangeGenovaX;
-
-            bool suctionRangeGhostY;
-            bool suctionRangeSkelY;
-            bool suctionRangeInvisY;
-            bool suctionRangeGenovaY;
-
-            vacuumframe++;
-            if (vacuumframe >= 20)
-                vacuumframe = 0;
-
-            victoryFrame++;
-            if (victoryFrame >= 20)
-                victoryFrame = 0;
+    {
+        ProfScope scope(PROF_GENOVA);
+        for (int i = 0; i < enemyCount; i++)
+        {
+            if (enemyDisappeared[i] || enemyTypes[i] != 3)
+                continue;
 
-            walkframe++;
-            if (walkframe >= 32)
-                walkframe = 0;
+            EnemyCold &c = en.cold[i];
+            bool goingRight = en.goingRight[i];
 
-            for (int i = 0; i < 6; i++)
+            // once per tick it advances, a far Genova catches up on its wind-up here
+            for (int s = 0; s < gs.enemySteps[i]; s++)
             {
-                genova_sprite[i].setPosition(enemyX[1], enemyY[1]);
-                genova_sprite[i].setPosition(enemyX[5], enemyY[5]);
+                // decrement per-enemy fireball cooldown (frames)
+                if (c.fireballCooldown > 0)
+                    c.fireballCooldown -= 1;
+                updateGenovaAttack(c.genovaIsAttacking, goingRight,
+                                   c.genovaAttackFrame, c.fireballCooldown, c.fireballSpawned,
+                                   enemyX[i], enemyY[i], gs.projectiles, gs.fireballSpeed);
             }
+            en.goingRight[i] = goingRight;
+        }
+    }
+
+    {
+        ProfScope scope(PROF_PROJECTILES);
+        update_projectiles(gs.projectiles, lvl, cell_size, player_x, player_y, gs.lifeCount, gs.damageCooldown, vacuum, gs.fireballHit);
+    }
 
-            bool movingLeft = Keyboard::isKeyPressed(Keyboard::Left);
-            bool movingRight = Keyboard::isKeyPressed(Keyboard::Right);
-            bool pressingJump = Keyboard::isKeyPressed(Keyboard::C);
-            bool pressingUp = Keyboard::isKeyPressed(Keyboard::W);
-            bool pressingDown = Keyboard::isKeyPressed(Keyboard::S);
-            bool vacuum = Keyboard::isKeyPressed(Keyboard::Space);
-            bool bulkThrow = Keyboard::isKeyPressed(Keyboard::Q);
+    if (vacuum && !gs.victoryAnimation)
+    {
+        ProfScope scope(PROF_VACUUM);
+
+        // Only enemies in the suction box can be pulled in. Where the nozzle
+        // only acts on one side of the player (right, or just one of up/down)
+        // the half disc around the box's half on that side is enough; facing
+        // left moves everything in the box, and up+down pulls from both sides.
+        if (pressingUp != pressingDown)
+            grid_query_cone(grid, en, player_x, player_y, 0, pressingUp ? -1 : 1, hypot(150.0f, 32.0f) + 1, 0, nearby);
+        else if (pressingUp)
+            grid_query_box(grid, en, player_x - 150, player_y - 32, player_x + 150, player_y + 32, nearby);
+        else if (facingRight)
+            grid_query_cone(grid, en, player_x, player_y, 1, 0, hypot(100.0f, 100.0f) + 1, 0, nearby);
+        else
+            grid_query_box(grid, en, player_x - 100, player_y - 100, player_x + 100, player_y + 100, nearby);
+
+        for (int k = 0; k < (int)nearby.size(); k++)
+        {
+            int i = nearby[k];
+            if (enemyDisappeared[i] || enemySucked[i])
+                continue;
 
-            static bool singleThrowPressed = false;
-            bool singleThrow = false;
+            bool suctionRangeX;
+            bool suctionRangeY;
 
-            // E press
-            if (Keyboard::isKeyPressed(Keyboard::E) && !singleThrowPressed)
+            if (pressingUp || pressingDown)
             {
-                singleThrow = true;
-                singleThrowPressed = true;
+                suctionRangeX = enemyX[i] >= (player_x - 150) && enemyX[i] <= (player_x + 150);
+                suctionRangeY = enemyY[i] >= (player_y - 32) && enemyY[i] <= (player_y + 32);
             }
-            if (!Keyboard::isKeyPressed(Keyboard::E))
+            else
             {
-                singleThrowPressed = false;
+                suctionRangeX = enemyX[i] >= (player_x - 100) && enemyX[i] <= (player_x + 100);
+                suctionRangeY = enemyY[i] >= (player_y - 100) && enemyY[i] <= (player_y + 100);
             }
 
-            if (!onGround)
+            if (!suctionRangeX || !suctionRangeY)
+                continue;
+
+            // If Genova is currently attacking, vacuum has no effect on it
+            if (enemyTypes[i] == 3 && en.cold[i].genovaIsAttacking)
+                continue;
+
+            // Horizontal suction (left/right)
+            if (!pressingUp && !pressingDown && backCount < gs.backpackCap)
             {
-                if (facingRight)
-                    PlayerSprite.setTexture(PlayerTextureJumpRight);
-                else
-                    PlayerSprite.setTexture(PlayerTextureJumpLeft);
+                if (facingRight && backCount < gs.backpackCap)
+                {
+                    if (enemyX[i] >= player_x && suctionRangeX && suctionRangeY)
+                    {
+                        enemyX[i] -= suctionSpeed;
+                        if (abs(enemyX[i] - player_x) < suctionSpeed)
+                        {
+                            backpack[backCount++] = enemy_handle(en, i);
+                            enemyDisappeared[i] = true;
+                            enemySucked[i] = true;
+                        }
+                    }
+                }
+                else if (backCount < gs.backpackCap)
+                {
+                    enemyX[i] += suctionSpeed;
+                    if (enemyX[i] <= player_x && suctionRangeX && suctionRangeY)
+                    {
+                        if (abs(enemyX[i] - player_x) < suctionSpeed)
+                        {
+                            backpack[backCount++] = enemy_handle(en, i);
+                            enemyDisappeared[i] = true;
+                            enemySucked[i] = true;
+                        }
+                    }
+                }
             }
-            else if (movingLeft)
+
+            // Vertical suction (up/down)
+            else if (pressingUp && enemyY[i] <= player_y && backCount < gs.backpackCap)
             {
-                facingRight = false;
-                PlayerSprite.setTexture(PlayerTextureLeft);
+                // If Genova is attacking, vacuum has no effect on it
+                if (enemyTypes[i] == 3 && en.cold[i].genovaIsAttacking)
+                    continue;
+                enemyY[i] += suctionSpeed;
+                if (suctionRangeX && suctionRangeY)
+                {
+                    if (abs(enemyY[i] - player_y) < suctionSpeed)
+                    {
+                        backpack[backCount++] = enemy_handle(en, i);
+                        enemyDisappeared[i] = true;
+                        enemySucked[i] = true;
+                    }
+                }
             }
-            else if (movingRight)
+            else if (pressingDown && enemyY[i] >= player_y && backCount < gs.backpackCap)
             {
-                facingRight = true;
-                PlayerSprite.setTexture(PlayerTextureRight);
+                // If Genova is attacking, vacuum has no effect on it
+                if (enemyTypes[i] == 3 && en.cold[i].genovaIsAttacking)
+                    continue;
+                enemyY[i] -= suctionSpeed;
+
+                if (suctionRangeX && suctionRangeY)
+                {
+                    if (abs(enemyY[i] - player_y) < suctionSpeed)
+                    {
+                        backpack[backCount++] = enemy_handle(en, i);
+                        enemyDisappeared[i] = true;
+                        enemySucked[i] = true;
+                    }
+                }
             }
-            else if (pressingUp)
+
+            grid_update(grid, en, i);
+        }
+    }
+
+    {
+        ProfScope scope(PROF_THROWN);
+        if (singleThrow && !(pressingDown || pressingUp) && backCount > 0)
+        {
+            gs.throwVelocityX = 15.0f;
+
+            if (!facingRight && gs.throwVelocityX > 0.0f)
             {
-                facingRight = false;
-                PlayerSprite.setTexture(PlayerTextureUp);
+                gs.throwVelocityX = -gs.throwVelocityX;
             }
-            else if (pressingDown)
+
+            EnemyHandle thrownEnemy = backpack[--backCount];
+            int enemyIdx = enemy_index(en, thrownEnemy);
+
+            enemyDisappeared[enemyIdx] = false;
+            enemyThrown[enemyIdx] = true;
+            en.cold[enemyIdx].throwVelocityX = gs.throwVelocityX;
+            en.cold[enemyIdx].throwVelocityY = 0;
+            enemyX[enemyIdx] = player_x;
+            enemyY[enemyIdx] = player_y;
+            enemySucked[enemyIdx] = false;
+            grid_update(grid, en, enemyIdx);
+        }
+
+        if (singleThrow && (pressingDown || pressingUp) && backCount > 0)
+        {
+            gs.throwVelocityY = 15.0f;
+
+            if (!pressingDown && gs.throwVelocityY > 0.0f)
             {
-                facingRight = false;
-                PlayerSprite.setTexture(PlayerTextureDown);
+                gs.throwVelocityY = -gs.throwVelocityY;
             }
-            else
+
+            EnemyHandle thrownEnemy = backpack[--backCount];
+            int enemyIdx = enemy_index(en, thrownEnemy);
+
+            enemyDisappeared[enemyIdx] = false;
+            enemyThrown[enemyIdx] = true;
+            en.cold[enemyIdx].throwVelocityY = gs.throwVelocityY;
+            en.cold[enemyIdx].throwVelocityX = 0;
+            enemyX[enemyIdx] = player_x;
+            enemyY[enemyIdx] = player_y;
+            enemySucked[enemyIdx] = false;
+            grid_update(grid, en, enemyIdx);
+        }
+
+        if (bulkThrow && !(pressingDown || pressingUp) && backCount > 0)
+        {
+            gs.throwVelocityX = 15.0f;
+
+            // If sucked when facing left, make throw negative (ONLY if it was positive)
+            if (!facingRight && gs.throwVelocityX > 0.0f)
             {
-                if (facingRight)
-                    PlayerSprite.setTexture(PlayerTextureRight);
-                else
-                    PlayerSprite.setTexture(PlayerTextureLeft);
+                gs.throwVelocityX = -gs.throwVelocityX;
             }
 
-            if (pressingDown && pressingJump && onGround)
-                dropTimer = dropDuration;
-            else if (pressingJump && onGround)
-                velocityY = jumpStrength;
+            EnemyHandle thrownEnemy = backpack[--backCount];
+            int enemyIdx = enemy_index(en, thrownEnemy);
+
+            enemyDisappeared[enemyIdx] = false;
+            enemyThrown[enemyIdx] = true;
+            en.cold[enemyIdx].throwVelocityX = gs.throwVelocityX;
+            en.cold[enemyIdx].throwVelocityY = 0;
+            enemyX[enemyIdx] = player_x;
+            enemyY[enemyIdx] = player_y;
+            enemySucked[enemyIdx] = false;
+            grid_update(grid, en, enemyIdx);
+        }
 
-            if (dropTimer > 0)
-                dropTimer -= 1.0f / 60.0f;
+        // Check if Q pressed and any monster in backpack
+        else if (bulkThrow && (pressingDown || pressingUp) && backCount > 0)
+        {
+            gs.throwVelocityY = 15.0f;
 
-            dropDown = dropTimer > 0;
+            if (!pressingDown && gs.throwVelocityY > 0.0f)
+            {
+                gs.throwVelocityY = -gs.throwVelocityY;
+            }
 
-            if (dropCooldown > 0)
-                dropCooldown -= 1.0f / 60.0f;
+            EnemyHandle thrownEnemy = backpack[--backCount];
+            int enemyIdx = enemy_index(en, thrownEnemy);
+
+            enemyDisappeared[enemyIdx] = false;
+            enemyThrown[enemyIdx] = true;
+            en.cold[enemyIdx].throwVelocityY = gs.throwVelocityY;
+            en.cold[enemyIdx].throwVelocityX = 0;
+            enemyX[enemyIdx] = player_x;
+            enemyY[enemyIdx] = player_y;
+            enemySucked[enemyIdx] = false;
+            grid_update(grid, en, enemyIdx);
+        }
 
-            player_horizontal_collision(lvl, player_x, player_y, cell_size, PlayerHeight, PlayerWidth, speed, movingLeft, movingRight, victoryAnimation);
-            display_level(window, lvl, bgTex, bgSprite, blockTexture, blockSprite, oneWaySprite, slopeSprite, slopeBotSprite, height, width, cell_size, selectedLevel);
-            player_gravity(lvl, offset_y, velocityY, onGround, gravity, terminal_Velocity, player_x, player_y, cell_size, PlayerHeight, PlayerWidth, dropDown, dropCooldown, victoryAnimation);
+        const int enemySize = 64;
+        for (int ei = 0; ei < enemyCount; ei++)
+        {
+            if (!enemyThrown[ei])
+                continue;
 
-            if (!victoryAnimation)
+            // A horizontal throw wins over any vertical velocity left on the enemy
+            float throwX = en.cold[ei].throwVelocityX;
+            float throwY = throwX != 0 ? 0 : en.cold[ei].throwVelocityY;
+            if (throwX != 0 || throwY != 0)
             {
-                if (!movingLeft && !movingRight)
-                {
-                    window.draw(PlayerSprite);
-                }
-                PlayerSprite.setPosition(player_x, player_y);
-
-                if (movingLeft && onGround)
+                SweepHit wall = sweep_box(lvl, lvl.solidBits, enemyX[ei], enemyY[ei], enemySize, enemySize,
+                                          throwX, throwY, cell_size);
+                if (wall.hit)
                 {
-                    int frameIndex = (walkframe / 20) % 4; // Frames 0-3
-                    walk_sprite[frameIndex].setPosition(player_x, player_y);
-                    walk_sprite[frameIndex].setScale(2, 2);
-                    window.draw(walk_sprite[frameIndex]);
-                }
-                else if (movingRight && onGround)
-                {
-                    int frameIndex = 4 + ((walkframe / 20) % 4); // Frames 4-7
-                    walk_sprite[frameIndex].setPosition(player_x, player_y);
-                    walk_sprite[frameIndex].setScale(2, 2);
-                    window.draw(walk_sprite[frameIndex]);
+                    enemyDisappeared[ei] = true;
+                    enemyThrown[ei] = false;
                 }
                 else
                 {
-                    window.draw(PlayerSprite);
+                    enemyX[ei] += throwX;
+                    enemyY[ei] += throwY;
                 }
             }
 
-            // Check left, mid and right points underneath player sprite
-            // If player sprite is on slope blocks, increase player axes to give slide effect
-            if (selectedLevel == 2)
-            {
-                if (onGround)
-                {
-                    int slopeGridY = (int)(player_y + PlayerHeight) / cell_size;
+            grid_update(grid, en, ei);
+        }
+    }
 
-                    int slopeGridXLeft = (int)(player_x) / cell_size;
-                    int slopeGridXMid = (int)(player_x + PlayerWidth / 2) / cell_size;
-                    int slopeGridXRight = (int)(player_x + PlayerWidth - 1) / cell_size;
+    // Reduce cooldown
+    if (gs.damageCooldown > 0.0f)
+    {
+        gs.damageCooldown -= gs.tickDt;
+    }
 
-                    char tileLeft = ' ', tileMid = ' ', tileRight = ' ';
+    // Reduce life and increase cool down if monster in proximity
+    bool anyThrown = false;
+    for (int ti = 0; ti < enemyCount; ti++)
+        if (enemyThrown[ti])
+        {
+            anyThrown = true;
+            break;
+        }
 
-                    if (slopeGridY >= 0 && slopeGridY < height)
-                    {
-                        if (slopeGridXLeft >= 0 && slopeGridXLeft < width)
-                            tileLeft = lvl[slopeGridY][slopeGridXLeft];
-                        if (slopeGridXMid >= 0 && slopeGridXMid < width)
-                            tileMid = lvl[slopeGridY][slopeGridXMid];
-                        if (slopeGridXRight >= 0 && slopeGridXRight < width)
-                            tileRight = lvl[slopeGridY][slopeGridXRight];
-                    }
+    // A fireball that hit the player while the cooldown was still running out counts here
+    if (!vacuum && (activeMonsterCollision || gs.fireballHit) && (!anyThrown) &&
+        gs.damageCooldown <= 0.0f)
+    {
+        // Reduce life till -1 (to check for last life)
+        if (gs.lifeCount > -1)
+        {
+            gs.lifeCount -= 1;
+        }
+        gs.damageCooldown = 2.0f;
+    }
 
-                    if (tileLeft == '/' || tileMid == '/' || tileRight == '/')
-                    {
-                        player_x += 2.0f;
-                        player_y += 2.0f;
-                    }
-                    else if (tileLeft == '\\' || tileMid == '\\' || tileRight == '\\')
-                    {
-                        player_x -= 2.0f;
-                        player_y += 2.0f;
-                    }
-                }
+    // Clear the fireball hit flag after applying damage so single hit counts once
+    gs.fireballHit = false;
+
+    // Enemies destroyed by a throw are gone for good, drop them from the store
+    for (int i = enemyCount - 1; i >= 0; i--)
+    {
+        if (enemyDisappeared[i] && !enemySucked[i] && !enemyThrown[i])
+        {
+            grid_remove(grid, en, i);
+            enemy_remove(en, i);
+        }
+    }
+
+    // Level progression from 1 to 2, and 2 to main menu
+    bool allEnemiesGone = true;
+    for (int i = 0; i < enemy_count(en); i++)
+    {
+        if (!enemyDisappeared[i])
+        {
+            allEnemiesGone = false;
+            break;
+        }
+    }
+    if (!gs.victoryAnimation && allEnemiesGone && backCount == 0)
+    {
+        gs.victoryAnimation = true;
+        gs.victoryTimer = 0.0;
+    }
+
+    if (gs.victoryAnimation)
+    {
+        gs.victoryTimer += gs.tickDt;
+
+        if (gs.victoryTimer > 4.0f)
+        {
+            gs.victoryAnimation = false;
+
+            if (selectedLevel < (int)levelTable.size())
+            {
+                selectedLevel++;
+                startLevel(gs);
             }
-            
-            for (int i = 0; i < MAX_ENEMIES; i++)
+            else
             {
-                if (enemyDisappeared[i] || enemySucked[i] || enemyThrown[i])
-                    continue;
-
-                if (enemyTypes[i] == 0)
-                { // Ghost
-                    updateGhost(lvl, enemyX[i], enemyY[i], enemyGoingRight[i],
-                                ghostSpeed, enemyVelocityY[i], cell_size,
-                                ghostSpr, ghostLeftTex, ghostRightTex);
-                }
-                else if (enemyTypes[i] == 1)
-                { // Skeleton
-                    updateskel(lvl, enemyX[i], enemyY[i], enemyGoingRight[i],
-                               enemySpeedArr[i], enemyVelocityY[i], cell_size,
-                               skelSpr, skelLeftTex, skelRightTex,
-                               player_x, player_y, enemyJumpCooldownArr[i], enemyWalkTimerArr[i], height, width);
-                }
-                else if (enemyTypes[i] == 2)
-                { // Invisible Man
-                    updateinvisibleman(enemyVelocityY[i], lvl, cell_size, player_y,
-                                       player_x, enemyX[i], enemyY[i], enemyGoingRight[i],
-                                       invisSpeed, invisSpr, invisLeftTex, invisRightTex,
-                                       isInvisible, invisibleTimer, invisibleDuration,
-                                       nextDisappearTime, Disappearing, invisDisappearFrame, height, width);
-                }
-                else if (enemyTypes[i] == 3)
-                { // Genova
-                    // Use per-enemy attack state arrays so Genovas don't interfere
-                    updateGenova(lvl, cell_size, player_x, player_y, enemyX[i], enemyY[i],
-                                 enemyGoingRight[i], enemySpeedArr[i], genovaSpr,
-                                 genovaLeftTex, genovaRightTex, vacuumframe,
-                                 genovaIsAttackingArr[i], genovaAttackFrameArr[i], fireballCooldownArr[i], height, width);
-                }
+                gs.gameState = 0;
             }
+        }
+    }
+
+    // Go to main menu and reset after negative life count
+    if (gs.lifeCount < 0)
+    {
+        for (int i = 0; i < backpackMax; ++i)
+        {
+            backpack[i] = EnemyHandle(); // empty handle, refers to no monster
+        }
+
+        backCount = 0;
+        gs.gameState = 0;
+    }
+}
+
+// Where each tick's GameInput comes from
+const int INPUT_LIVE = 0;     // the keyboard
+const int INPUT_RANDOM = 1;   // button mashing for the headless soak run
+const int INPUT_PLAYBACK = 2; // ticks read back from a recording
+
+// Everything needed to replay a run: the RNG seed and level it started from,
+// the tick length and one input bitmask per stepGame call
+struct InputRecording
+{
+    unsigned seed = 1;
+    int level = 1;
+    float tickDt = TICK_DT;
+    vector<unsigned char> ticks;
+    unsigned long long finalHash = 0; // hash_game_state after the last tick
+};
+
+struct InputSource
+{
+    int mode = INPUT_LIVE;
+    const InputRecording *playback = nullptr;
+    size_t cursor = 0; // next playback tick
+    long tick = 0;     // ticks produced so far
+    GameInput held;    // random input, kept for half a second like a player would
+};
+
+unsigned char pack_input(const GameInput &in)
+{
+    return (in.movingLeft ? 1 : 0) | (in.movingRight ? 2 : 0) | (in.pressingJump ? 4 : 0) |
+           (in.pressingUp ? 8 : 0) | (in.pressingDown ? 16 : 0) | (in.vacuum ? 32 : 0) |
+           (in.bulkThrow ? 64 : 0) | (in.throwKey ? 128 : 0);
+}
+
+GameInput unpack_input(unsigned char bits)
+{
+    GameInput in;
+    in.movingLeft = bits & 1;
+    in.movingRight = bits & 2;
+    in.pressingJump = bits & 4;
+    in.pressingUp = bits & 8;
+    in.pressingDown = bits & 16;
+    in.vacuum = bits & 32;
+    in.bulkThrow = bits & 64;
+    in.throwKey = bits & 128;
+    return in;
+}
+
+// Random button mashing used to drive the headless soak run
+GameInput randomInput()
+{
+    GameInput in;
+    in.movingLeft = rand() % 3 == 0;
+    in.movingRight = !in.movingLeft && rand() % 2 == 0;
+    in.pressingJump = rand() % 4 == 0;
+    in.pressingUp = rand() % 8 == 0;
+    in.pressingDown = !in.pressingUp && rand() % 8 == 0;
+    in.vacuum = rand() % 3 == 0;
+    in.bulkThrow = rand() % 10 == 0;
+    in.throwKey = rand() % 5 == 0;
+    return in;
+}
+
+// Input for the next tick. Returns false once a playback has run out.
+bool next_input(InputSource &src, GameInput &in)
+{
+    if (src.mode == INPUT_PLAYBACK)
+    {
+        if (!src.playback || src.cursor >= src.playback->ticks.size())
+            return false;
+        in = unpack_input(src.playback->ticks[src.cursor++]);
+    }
+    else if (src.mode == INPUT_RANDOM)
+    {
+        if (src.tick % 30 == 0)
+            src.held = randomInput();
+        in = src.held;
+    }
+    else
+    {
+        in = readKeyboardInput();
+    }
+    src.tick++;
+    return true;
+}
+
+// File layout (little-endian): "TPREC1\0\0", seed u32, level i32, tickDt f32,
+// tick count u32, final hash u64, then one byte per tick
+bool save_recording(const InputRecording &rec, const string &path)
+{
+    ofstream out(path, ios::binary);
+    if (!out)
+        return false;
+
+    unsigned count = (unsigned)rec.ticks.size();
+    out.write("TPREC1\0\0", 8);
+    out.write((const char *)&rec.seed, 4);
+    out.write((const char *)&rec.level, 4);
+    out.write((const char *)&rec.tickDt, 4);
+    out.write((const char *)&count, 4);
+    out.write((const char *)&rec.finalHash, 8);
+    if (count > 0)
+        out.write((const char *)rec.ticks.data(), count);
+    return (bool)out;
+}
+
+bool load_recording(InputRecording &rec, const string &path)
+{
+    ifstream in(path, ios::binary);
+    char magic[8];
+    unsigned count = 0;
+    if (!in.read(magic, 8) || string(magic, 6) != "TPREC1")
+        return false;
+
+    in.read((char *)&rec.seed, 4);
+    in.read((char *)&rec.level, 4);
+    in.read((char *)&rec.tickDt, 4);
+    in.read((char *)&count, 4);
+    in.read((char *)&rec.finalHash, 8);
+    if (!in || rec.tickDt != TICK_DT) // recorded at another tick rate, it wouldn't replay
+        return false;
+    rec.ticks.resize(count);
+    if (count > 0)
+        in.read((char *)rec.ticks.data(), count);
+    return (bool)in;
+}
+
+void hash_mix(unsigned long long &h, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+}
+
+// Fingerprint of the parts of the state a replay must reproduce
+unsigned long long hash_game_state(const GameState &gs)
+{
+    unsigned long long h = 1469598103934665603ULL;
+    hash_mix(h, &gs.gameState, sizeof(gs.gameState));
+    hash_mix(h, &gs.selectedLevel, sizeof(gs.selectedLevel));
+    hash_mix(h, &gs.rng, sizeof(gs.rng));
+    hash_mix(h, &gs.player_x, sizeof(gs.player_x));
+    hash_mix(h, &gs.player_y, sizeof(gs.player_y));
+    hash_mix(h, &gs.velocityY, sizeof(gs.velocityY));
+    hash_mix(h, &gs.lifeCount, sizeof(gs.lifeCount));
+    hash_mix(h, &gs.backCount, sizeof(gs.backCount));
+    hash_mix(h, &gs.projectiles.live, sizeof(gs.projectiles.live));
+
+    const EnemyStore &en = gs.enemies;
+    int count = enemy_count(en);
+    hash_mix(h, &count, sizeof(count));
+    if (count > 0)
+    {
+        hash_mix(h, en.x.data(), count * sizeof(float));
+        hash_mix(h, en.y.data(), count * sizeof(float));
+        hash_mix(h, en.disappeared.data(), count);
+        hash_mix(h, en.thrown.data(), count);
+    }
+    return h;
+}
+
+// Save states: the whole GameState as one versioned binary blob, for
+// quick-save/quick-load, restarting benchmark scenarios mid-level and
+// bisecting desyncs. Containers are copied wholesale (the enemy grid's bucket
+// order included), so a restored game steps exactly like the saved one did.
+// Small structs are stored in their in-memory layout, so blobs only load into
+// the same build; bump SAVE_STATE_VERSION whenever a field changes.
+// Layout: "TPSAVE\0\0", version u32, total size u32, then state_fields.
+const unsigned SAVE_STATE_VERSION = 4;
+const int SAVE_STATE_HEADER = 16;
+
+// Writes the fields into out, or reads them back from in, so the one field
+// list in state_fields serves both directions
+struct StateIO
+{
+    bool reading = false;
+    vector<unsigned char> *out = nullptr;
+    const unsigned char *in = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool ok = true;
+};
+
+void state_raw(StateIO &io, void *data, size_t size)
+{
+    if (!io.reading)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        io.out->insert(io.out->end(), bytes, bytes + size);
+        return;
+    }
+    if (!io.ok || size > io.size - io.pos)
+    {
+        io.ok = false;
+        return;
+    }
+    memcpy(data, io.in + io.pos, size);
+    io.pos += size;
+}
 
-            // After updates, ensure no enemy is stuck inside solid tiles; if so, relocate them
-            for (int i = 0; i < MAX_ENEMIES; ++i)
+// Structs saved as raw bytes have no padding, see EnemyCold::pad
+static_assert(sizeof(EnemyCold) == 11 * 4, "EnemyCold has padding");
+static_assert(sizeof(EnemyHandle) == 2 * 4, "EnemyHandle has padding");
+
+template <class T>
+void state_value(StateIO &io, T &value)
+{
+    static_assert(is_trivially_copyable<T>::value, "save states copy fields as raw bytes");
+    state_raw(io, &value, sizeof(T));
+}
+
+// A bool is one byte on disk; anything but 0 or 1 marks a damaged blob
+void state_value(StateIO &io, bool &value)
+{
+    unsigned char byte = value ? 1 : 0;
+    state_raw(io, &byte, 1);
+    if (io.reading)
+    {
+        io.ok = io.ok && byte <= 1;
+        value = byte == 1;
+    }
+}
+
+template <class T>
+void state_vector(StateIO &io, vector<T> &v)
+{
+    static_assert(is_trivially_copyable<T>::value, "save states copy fields as raw bytes");
+    unsigned count = (unsigned)v.size();
+    state_value(io, count);
+    if (io.reading)
+    {
+        if (!io.ok || count > (io.size - io.pos) / sizeof(T))
+        {
+            io.ok = false;
+            return;
+        }
+        v.resize(count);
+    }
+    if (count > 0)
+        state_raw(io, v.data(), count * sizeof(T));
+}
+
+void state_fields(StateIO &io, GameState &gs, bool &withLevel)
+{
+    state_value(io, gs.cell_size);
+    state_value(io, gs.height);
+    state_value(io, gs.width);
+
+    // Rewind blobs leave the tile map out, see load_game_state
+    state_value(io, withLevel);
+    if (withLevel)
+    {
+        TileMap &lvl = gs.lvl;
+        state_value(io, lvl.height);
+        state_value(io, lvl.width);
+        state_vector(io, lvl.tiles);
+        state_vector(io, lvl.flags);
+        state_value(io, lvl.rowWords);
+        state_vector(io, lvl.solidBits);
+        state_vector(io, lvl.groundBits);
+        state_vector(io, lvl.nearestAir);
+        state_vector(io, lvl.nearestGround);
+    }
+
+    state_value(io, gs.gameState);
+    state_value(io, gs.selectedLevel);
+    // Field by field, so each bool goes through the 0/1 check
+    GameInput &in = gs.input;
+    state_value(io, in.movingLeft);
+    state_value(io, in.movingRight);
+    state_value(io, in.pressingJump);
+    state_value(io, in.pressingUp);
+    state_value(io, in.pressingDown);
+    state_value(io, in.vacuum);
+    state_value(io, in.bulkThrow);
+    state_value(io, in.throwKey);
+    state_value(io, gs.seed);
+    state_value(io, gs.rng);
+    state_value(io, gs.tick);
+    state_value(io, gs.nearX0);
+    state_value(io, gs.nearY0);
+    state_value(io, gs.nearX1);
+    state_value(io, gs.nearY1);
+    state_value(io, gs.tickDt);
+
+    state_value(io, gs.player_x);
+    state_value(io, gs.player_y);
+    state_value(io, gs.offset_y);
+    state_value(io, gs.velocityY);
+    state_value(io, gs.onGround);
+    state_value(io, gs.facingRight);
+    state_value(io, gs.playerPose);
+    state_value(io, gs.PlayerHeight);
+    state_value(io, gs.PlayerWidth);
+    state_value(io, gs.speed);
+    state_value(io, gs.dropTimer);
+    state_value(io, gs.dropDuration);
+    state_value(io, gs.jumpStrength);
+    state_value(io, gs.gravity);
+    state_value(io, gs.terminal_Velocity);
+    state_value(io, gs.dropCooldown);
+    state_value(io, gs.damageCooldown);
+    state_value(io, gs.dropDown);
+    state_value(io, gs.lifeCount);
+    state_value(io, gs.victoryTimer);
+    state_value(io, gs.victoryAnimation);
+    state_value(io, gs.walkframe);
+    state_value(io, gs.vacuumframe);
+    state_value(io, gs.victoryFrame);
+    state_value(io, gs.singleThrowPressed);
+    state_value(io, gs.throwVelocityX);
+    state_value(io, gs.throwVelocityY);
+    state_value(io, gs.backpack);
+    state_value(io, gs.backCount);
+    state_value(io, gs.backpackCap);
+    state_value(io, gs.ghostSpeed);
+    state_value(io, gs.invisSpeed);
+    state_value(io, gs.fireballSpeed);
+    state_value(io, gs.isInvisible);
+    state_value(io, gs.invisibleTimer);
+    state_value(io, gs.invisibleDuration);
+    state_value(io, gs.Disappearing);
+    state_value(io, gs.invisDisappearFrame);
+    state_value(io, gs.nextDisappearTime);
+    state_value(io, gs.invisFrameCounter);
+
+    EnemyStore &en = gs.enemies;
+    state_vector(io, en.type);
+    state_vector(io, en.x);
+    state_vector(io, en.y);
+    state_vector(io, en.velocityY);
+    state_vector(io, en.speed);
+    state_vector(io, en.goingRight);
+    state_vector(io, en.disappeared);
+    state_vector(io, en.sucked);
+    state_vector(io, en.thrown);
+    state_vector(io, en.cold);
+    state_vector(io, en.denseSlot);
+    state_vector(io, en.slotDense);
+    state_vector(io, en.slotGen);
+    state_vector(io, en.freeSlots);
+
+    EnemyGrid &grid = gs.enemyGrid;
+    state_value(io, grid.cellSize);
+    state_value(io, grid.rows);
+    state_value(io, grid.cols);
+    // Only occupied buckets are stored, as (index, contents): a wide level has
+    // tens of thousands of cells and almost all of them are empty
+    unsigned buckets = (unsigned)grid.buckets.size();
+    unsigned occupied = 0;
+    if (!io.reading)
+        for (const vector<int> &bucket : grid.buckets)
+            occupied += bucket.empty() ? 0 : 1;
+    state_value(io, buckets);
+    state_value(io, occupied);
+    if (io.reading)
+    {
+        if (!io.ok || buckets != (unsigned long long)grid.rows * grid.cols || occupied > buckets)
+        {
+            io.ok = false;
+            return;
+        }
+        grid.buckets.resize(buckets);
+        for (vector<int> &bucket : grid.buckets)
+            bucket.clear();
+        for (unsigned k = 0; k < occupied && io.ok; k++)
+        {
+            unsigned b = 0;
+            state_value(io, b);
+            if (b >= buckets)
+                io.ok = false;
+            else
+                state_vector(io, grid.buckets[b]);
+        }
+    }
+    else
+    {
+        for (unsigned b = 0; b < buckets; b++)
+            if (!grid.buckets[b].empty())
             {
-                if (enemyDisappeared[i] || enemySucked[i])
-                    continue;
-                if (overlapsSolid(lvl, enemyX[i], enemyY[i], 64, 64, cell_size))
-                {
-                    // Avoid relocating enemies that are currently moving upward (jumping),
-                    // since they may temporarily intersect tiles while ascending.
-                    if (enemyVelocityY[i] < 0.0f)
-                        continue;
-                    int spawnCol = (int)(enemyX[i] / cell_size);
-                    int spawnRow = (int)(enemyY[i] / cell_size);
-                    findValidSpawn(lvl, spawnRow, spawnCol, enemyTypes[i], height, width);
-                    enemyX[i] = spawnCol * cell_size;
-                    enemyY[i] = spawnRow * cell_size;
-                }
+                state_value(io, b);
+                state_vector(io, grid.buckets[b]);
+            }
+    }
+    state_vector(io, grid.slotCell);
+    state_vector(io, grid.slotPos);
+
+    ProjectilePool &pool = gs.projectiles;
+    state_vector(io, pool.x);
+    state_vector(io, pool.y);
+    state_vector(io, pool.velocityX);
+    state_vector(io, pool.active);
+    state_vector(io, pool.freeSlots);
+    state_value(io, pool.live);
+    state_value(io, gs.fireballHit);
+}
+
+// Replaces out with the save state of gs. out keeps its capacity, so saving
+// into the same buffer again doesn't allocate.
+// withLevel false leaves out the tile map, which only depends on selectedLevel;
+// such a blob loads only into a game that can supply the level itself
+void save_game_state(const GameState &gs, vector<unsigned char> &out, bool withLevel = true)
+{
+    out.clear();
+    out.insert(out.end(), (const unsigned char *)"TPSAVE\0\0", (const unsigned char *)"TPSAVE\0\0" + 8);
+    unsigned version = SAVE_STATE_VERSION;
+    unsigned size = 0;
+    StateIO io;
+    io.out = &out;
+    state_value(io, version);
+    state_value(io, size);
+    state_fields(io, const_cast<GameState &>(gs), withLevel); // only read while writing
+
+    size = (unsigned)out.size();
+    memcpy(out.data() + 12, &size, 4);
+}
+
+// Spawn index entries are -1 or a packed cell inside the map
+bool spawn_index_valid(const TileMap &lvl, const vector<int> &nearest)
+{
+    for (int packed : nearest)
+        if (packed != -1 && (packed < 0 || (packed >> 16) >= lvl.height || (packed & 0xffff) >= lvl.width))
+            return false;
+    return true;
+}
+
+// Sizes of a tile map read from a blob against its dimensions
+bool tile_map_consistent(const TileMap &lvl)
+{
+    size_t cells = (size_t)lvl.height * lvl.width;
+    return lvl.height > 0 && lvl.width > 0 && lvl.height <= 0xffff && lvl.width <= 0xffff &&
+           lvl.tiles.size() == cells && lvl.flags.size() == cells && lvl.rowWords == (lvl.width + 63) / 64 &&
+           lvl.solidBits.size() == (size_t)lvl.height * lvl.rowWords &&
+           lvl.groundBits.size() == (size_t)lvl.height * lvl.rowWords && lvl.nearestAir.size() == cells &&
+           lvl.nearestGround.size() == cells && spawn_index_valid(lvl, lvl.nearestAir) &&
+           spawn_index_valid(lvl, lvl.nearestGround);
+}
+
+// Everything the simulation indexes with a value from the state itself: a blob
+// that decodes cleanly but fails this would read out of bounds on the next tick.
+// The tile map itself is checked by tile_map_consistent.
+bool state_consistent(const GameState &gs)
+{
+    if (gs.height != gs.lvl.height || gs.width != gs.lvl.width || gs.cell_size <= 0 || gs.cell_size > 1024 ||
+        gs.tickDt != TICK_DT)
+        return false;
+    if (!isfinite(gs.player_x) || !isfinite(gs.player_y) || !isfinite(gs.velocityY))
+        return false;
+    if (gs.backpackCap < 1 || gs.backpackCap > backpackMax || gs.backCount < 0 || gs.backCount > gs.backpackCap)
+        return false;
+
+    // Enemy arrays all as long as type; slots and dense indices map onto each other
+    const EnemyStore &en = gs.enemies;
+    size_t n = en.type.size();
+    if (en.x.size() != n || en.y.size() != n || en.velocityY.size() != n || en.speed.size() != n ||
+        en.goingRight.size() != n || en.disappeared.size() != n || en.sucked.size() != n || en.thrown.size() != n ||
+        en.cold.size() != n || en.denseSlot.size() != n || en.slotGen.size() != en.slotDense.size())
+        return false;
+    int slots = (int)en.slotDense.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        // EnemyCold is copied raw, so look at its bools as bytes before trusting them
+        const unsigned char *attacking = (const unsigned char *)&en.cold[i].genovaIsAttacking;
+        const unsigned char *spawned = (const unsigned char *)&en.cold[i].fireballSpawned;
+        if (*attacking > 1 || *spawned > 1 || !isfinite(en.x[i]) || !isfinite(en.y[i]) || !isfinite(en.velocityY[i]))
+            return false;
+        int slot = en.denseSlot[i];
+        if (en.type[i] < 0 || en.type[i] > 3 || slot < 0 || slot >= slots || en.slotDense[slot] != (int)i)
+            return false;
+    }
+    for (int slot = 0; slot < slots; slot++)
+        if (en.slotDense[slot] < -1 || en.slotDense[slot] >= (int)n)
+            return false;
+    for (int slot : en.freeSlots)
+        if (slot < 0 || slot >= slots || en.slotDense[slot] != -1)
+            return false;
+    for (int b = 0; b < gs.backCount; b++)
+    {
+        // Packed enemies are sucked and hidden, otherwise they could be removed
+        // while still in the backpack
+        int i = enemy_index(en, gs.backpack[b]);
+        if (i < 0 || !en.disappeared[i] || !en.sucked[i])
+            return false;
+    }
+
+    // Grid buckets hold live slots, and slotCell/slotPos point back at them
+    const EnemyGrid &grid = gs.enemyGrid;
+    int buckets = (int)grid.buckets.size();
+    if (grid.cellSize <= 0 || grid.rows <= 0 || grid.cols <= 0 || buckets != (long long)grid.rows * grid.cols ||
+        grid.slotCell.size() != grid.slotPos.size() || (int)grid.slotCell.size() > slots)
+        return false;
+    for (size_t slot = 0; slot < grid.slotCell.size(); slot++)
+    {
+        int cell = grid.slotCell[slot];
+        if (cell < -1 || cell >= buckets)
+            return false;
+        if (cell >= 0 && (grid.slotPos[slot] < 0 || grid.slotPos[slot] >= (int)grid.buckets[cell].size() ||
+                          grid.buckets[cell][grid.slotPos[slot]] != (int)slot))
+            return false;
+    }
+    for (const vector<int> &bucket : grid.buckets)
+        for (int slot : bucket)
+            if (slot < 0 || slot >= (int)grid.slotCell.size() || en.slotDense[slot] < 0)
+                return false;
+
+    const ProjectilePool &pool = gs.projectiles;
+    size_t shots = pool.x.size();
+    if (pool.y.size() != shots || pool.velocityX.size() != shots || pool.active.size() != shots || pool.live < 0 ||
+        pool.live > (int)shots)
+        return false;
+    for (int slot : pool.freeSlots)
+        if (slot < 0 || slot >= (int)shots || pool.active[slot])
+            return false;
+    for (size_t p = 0; p < shots; p++)
+        if (!isfinite(pool.x[p]) || !isfinite(pool.y[p]))
+            return false;
+    return true;
+}
+
+// Restores gs from a save state. A blob of another version, a damaged one or
+// one whose contents don't fit together returns false and leaves gs as it was.
+bool load_game_state(GameState &gs, const vector<unsigned char> &blob)
+{
+    unsigned version = 0;
+    unsigned size = 0;
+    if (blob.size() < SAVE_STATE_HEADER || memcmp(blob.data(), "TPSAVE", 6) != 0)
+        return false;
+    memcpy(&version, blob.data() + 8, 4);
+    memcpy(&size, blob.data() + 12, 4);
+    if (version != SAVE_STATE_VERSION || size != blob.size())
+        return false;
+
+    // Decoded on the side, so a blob that turns out bad costs nothing. The spare
+    // keeps the buffers of the state it replaced last time: rewinding loads every
+    // tick and a big level has tens of thousands of grid buckets to allocate.
+    static thread_local GameState loaded;
+    StateIO io;
+    io.reading = true;
+    io.in = blob.data();
+    io.size = blob.size();
+    io.pos = SAVE_STATE_HEADER;
+    bool withLevel = false;
+    state_fields(io, loaded, withLevel);
+    if (!io.ok || io.pos != io.size || loaded.selectedLevel < 1 || loaded.selectedLevel > (int)levelTable.size())
+        return false;
+
+    // levelChanged isn't saved, it's for the renderer: raise it when the loaded
+    // state plays another level, and keep one that is still pending.
+    // A blob without its tile map borrows gs's when it plays the same level and
+    // otherwise builds it from the level file, like startLevel did.
+    bool borrowed = false;
+    if (withLevel)
+    {
+        if (!tile_map_consistent(loaded.lvl))
+            return false;
+        loaded.levelChanged = gs.levelChanged || loaded.selectedLevel != gs.selectedLevel ||
+                              loaded.lvl.width != gs.lvl.width || loaded.lvl.tiles != gs.lvl.tiles;
+    }
+    else if (loaded.selectedLevel == gs.selectedLevel)
+    {
+        swap(loaded.lvl, gs.lvl);
+        borrowed = true;
+        loaded.levelChanged = gs.levelChanged;
+    }
+    else
+    {
+        build_level_tiles(loaded.lvl, levelTable[loaded.selectedLevel - 1]);
+        loaded.levelChanged = true;
+    }
+    if (!state_consistent(loaded))
+    {
+        if (borrowed)
+            swap(loaded.lvl, gs.lvl);
+        return false;
+    }
+
+    loaded.nearbyEnemies.swap(gs.nearbyEnemies); // scratch stays with gs
+    loaded.enemySteps.swap(gs.enemySteps);
+    swap(gs, loaded);
+    return true;
+}
+
+// Rewind: the last few seconds of play as save states. Every
+// REWIND_KEYFRAME_TICKS ticks a keyframe is stored, and in between each tick
+// is stored as its XOR against that keyframe. Both are run-length coded:
+// most of the entity arrays don't change from tick to tick, so a delta is
+// mostly zero runs. The tile map never changes within a level and is left out
+// of the blobs altogether. Everything lives in one arena used as a ring; when
+// it or the time window is full, the oldest keyframe goes together with the
+// deltas that depend on it. Keyframes come sooner when the deltas are big
+// (hordes), so a few groups always fit and evicting one never empties the
+// buffer. The arena starts at REWIND_ARENA_BYTES and doubles whenever it would
+// fill before REWIND_SECONDS are kept, up to REWIND_ARENA_MAX_BYTES; when that
+// still isn't enough the run's report says so.
+const int REWIND_SECONDS = 20;
+const int REWIND_KEYFRAME_TICKS = 60;
+const size_t REWIND_ARENA_BYTES = 4 << 20;
+const size_t REWIND_ARENA_MAX_BYTES = 64 << 20;
+
+struct RewindEntry
+{
+    size_t offset = 0; // in the arena
+    size_t size = 0;
+    bool key = false;
+    long serial = 0; // push number, tells keyframes apart
+};
+
+struct RewindBuffer
+{
+    vector<unsigned char> arena;
+    vector<RewindEntry> entries; // ring of capacity ticks, oldest at first
+    int first = 0;
+    int count = 0;
+    size_t head = 0;        // where the next entry goes
+    size_t usedBytes = 0;   // sum of the live entries
+    long serial = 0;
+    int sinceKey = 0;       // entries since the newest keyframe, itself included
+    size_t groupBytes = 0;  // and their size
+
+    vector<unsigned char> blob;    // scratch: the state being pushed or restored
+    vector<unsigned char> coded;   // scratch: its encoding
+    vector<unsigned char> keyBlob; // the newest keyframe, decoded
+    long keySerial = -1;
+    vector<unsigned char> zeros;   // what keyframes are coded against
+    size_t largest = 0;            // longest blob pushed, no decode may come out longer
+
+    long long encodeNs = 0; // total over pushes, for the per-tick figure
+    long pushes = 0;
+    long earlyDrops = 0;    // keyframe groups evicted for space, before REWIND_SECONDS were kept
+};
+
+void rewind_clear(RewindBuffer &rb)
+{
+    rb.first = 0;
+    rb.count = 0;
+    rb.head = 0;
+    rb.usedBytes = 0;
+    rb.sinceKey = 0;
+    rb.groupBytes = 0;
+    rb.keySerial = -1;
+}
+
+// Allocates the arena and the entry ring for REWIND_SECONDS of ticks; calling
+// it again keeps both allocations
+void rewind_init(RewindBuffer &rb, float tickDt)
+{
+    rb.arena.assign(REWIND_ARENA_BYTES, 0);
+    rb.entries.assign(max(2, (int)(REWIND_SECONDS / tickDt)), RewindEntry());
+    rewind_clear(rb);
+    rb.largest = 0;
+    rb.encodeNs = 0;
+    rb.pushes = 0;
+    rb.earlyDrops = 0;
+}
+
+RewindEntry &rewind_entry(RewindBuffer &rb, int k)
+{
+    return rb.entries[(rb.first + k) % rb.entries.size()];
+}
+
+unsigned char *rewind_put_varint(unsigned char *out, size_t v)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (unsigned char)v;
+    return out;
+}
+
+// Reads one varint, false when it runs past end or overflows
+bool rewind_get_varint(const unsigned char *&p, const unsigned char *end, size_t &v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        unsigned char b = *p++;
+        v |= (size_t)(b & 0x7f) << shift;
+        if (b < 0x80)
+            return true;
+    }
+    return false;
+}
+
+unsigned long long rewind_word(const unsigned char *p, size_t w)
+{
+    unsigned long long v;
+    memcpy(&v, p + w * 8, 8);
+    return v;
+}
+
+// cur XOR ref in 8-byte words: the size of cur, then (equal words, changed
+// words, the changed words XORed) triples. Both are padded with zeros to a
+// whole word first. Returns the length written to out, which is only ever
+// grown so encoding into it again doesn't clear or allocate.
+size_t rewind_encode(vector<unsigned char> &cur, vector<unsigned char> &ref, vector<unsigned char> &out)
+{
+    size_t n = cur.size();
+    size_t words = (n + 7) / 8;
+    cur.resize(words * 8, 0);
+    if (ref.size() < words * 8)
+        ref.resize(words * 8, 0);
+    if (out.size() < 32 + words * 8) // a triple never costs more than the words it covers
+        out.resize(32 + words * 8);
+
+    const unsigned char *a = cur.data();
+    const unsigned char *b = ref.data();
+    unsigned char *o = rewind_put_varint(out.data(), n);
+    size_t w = 0;
+    while (w < words)
+    {
+        size_t run = w;
+        while (run < words && rewind_word(a, run) == rewind_word(b, run))
+            run++;
+        size_t lit = run;
+        while (lit < words && rewind_word(a, lit) != rewind_word(b, lit))
+            lit++;
+
+        o = rewind_put_varint(o, run - w);
+        o = rewind_put_varint(o, lit - run);
+        for (size_t k = run; k < lit; k++)
+        {
+            unsigned long long x = rewind_word(a, k) ^ rewind_word(b, k);
+            memcpy(o, &x, 8);
+            o += 8;
+        }
+        w = lit;
+    }
+    return o - out.data();
+}
+
+// Undoes rewind_encode on the size bytes at p. False when they don't describe
+// a blob of at most largest bytes; out is then garbage.
+bool rewind_decode(const unsigned char *p, size_t size, size_t largest, vector<unsigned char> &ref,
+                   vector<unsigned char> &out)
+{
+    const unsigned char *end = p + size;
+    size_t n = 0;
+    if (!rewind_get_varint(p, end, n) || n > largest)
+        return false;
+    size_t words = (n + 7) / 8;
+    if (ref.size() < words * 8)
+        ref.resize(words * 8, 0);
+    out.resize(words * 8);
+    size_t w = 0;
+    while (w < words)
+    {
+        size_t run = 0, lit = 0;
+        if (!rewind_get_varint(p, end, run) || run > words - w)
+            return false;
+        memcpy(out.data() + w * 8, ref.data() + w * 8, run * 8);
+        w += run;
+        if (!rewind_get_varint(p, end, lit) || lit > words - w || lit > (size_t)(end - p) / 8)
+            return false;
+        for (size_t k = 0; k < lit; k++, w++)
+        {
+            unsigned long long x = rewind_word(p, k) ^ rewind_word(ref.data(), w);
+            memcpy(out.data() + w * 8, &x, 8);
+        }
+        p += lit * 8;
+    }
+    out.resize(n);
+    return true;
+}
+
+void rewind_drop_oldest(RewindBuffer &rb)
+{
+    // A delta is useless without its keyframe, so they leave together
+    do
+    {
+        rb.usedBytes -= rewind_entry(rb, 0).size;
+        rb.first = (rb.first + 1) % (int)rb.entries.size();
+        rb.count--;
+    } while (rb.count > 0 && !rewind_entry(rb, 0).key);
+    if (rb.count == 0)
+    {
+        rb.sinceKey = 0;
+        rb.groupBytes = 0;
+        rb.keySerial = -1;
+    }
+}
+
+// Moves the live entries, oldest first, to the start of a bigger arena
+void rewind_grow(RewindBuffer &rb, size_t bytes)
+{
+    vector<unsigned char> arena(bytes);
+    size_t at = 0;
+    for (int k = 0; k < rb.count; k++)
+    {
+        RewindEntry &e = rewind_entry(rb, k);
+        memcpy(arena.data() + at, rb.arena.data() + e.offset, e.size);
+        e.offset = at;
+        at += e.size;
+    }
+    rb.arena.swap(arena);
+    rb.head = at;
+}
+
+// Stores the first size bytes of rb.coded as the newest entry, evicting
+// whatever they overlap
+void rewind_place(RewindBuffer &rb, size_t size, bool key)
+{
+    if (rb.count == (int)rb.entries.size())
+        rewind_drop_oldest(rb);
+    // Filling up before the window is: double the arena, keeping a quarter
+    // spare for the ring's wrap
+    if (rb.count < (int)rb.entries.size() && rb.usedBytes + size > rb.arena.size() / 4 * 3 &&
+        rb.arena.size() < REWIND_ARENA_MAX_BYTES)
+        rewind_grow(rb, min(REWIND_ARENA_MAX_BYTES, rb.arena.size() * 2));
+    if (rb.head + size > rb.arena.size())
+    {
+        // Skip the arena's tail; whatever still lives there is the oldest
+        while (rb.count > 0 && rewind_entry(rb, 0).offset >= rb.head)
+        {
+            rewind_drop_oldest(rb);
+            rb.earlyDrops++;
+        }
+        rb.head = 0;
+    }
+    while (rb.count > 0 && rewind_entry(rb, 0).offset >= rb.head && rewind_entry(rb, 0).offset < rb.head + size)
+    {
+        rewind_drop_oldest(rb);
+        rb.earlyDrops++;
+    }
+
+    memcpy(rb.arena.data() + rb.head, rb.coded.data(), size);
+    RewindEntry &e = rb.entries[(rb.first + rb.count) % rb.entries.size()];
+    e.offset = rb.head;
+    e.size = size;
+    e.key = key;
+    e.serial = rb.serial++;
+    rb.count++;
+    rb.head += size;
+    rb.usedBytes += size;
+    if (key)
+        rb.keySerial = e.serial;
+    rb.sinceKey = key ? 1 : rb.sinceKey + 1;
+    rb.groupBytes = key ? size : rb.groupBytes + size;
+}
+
+// Records gs as the newest tick
+void rewind_push(RewindBuffer &rb, const GameState &gs)
+{
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    save_game_state(gs, rb.blob, false);
+    rb.largest = max(rb.largest, rb.blob.size());
+    bool key = rb.count == 0 || rb.sinceKey >= REWIND_KEYFRAME_TICKS || rb.groupBytes >= rb.arena.size() / 4;
+    size_t size = rewind_encode(rb.blob, key ? rb.zeros : rb.keyBlob, rb.coded);
+    // A state that big would wipe the whole buffer; better to keep the history it has
+    if (size <= rb.arena.size() / 2)
+    {
+        rewind_place(rb, size, key);
+        if (!key && rb.keySerial < 0)
+        {
+            // Its keyframe was evicted to make room, store it as one itself
+            rewind_clear(rb);
+            size = rewind_encode(rb.blob, rb.zeros, rb.coded);
+            key = true;
+            rewind_place(rb, size, key);
+        }
+        if (key)
+            rb.keyBlob = rb.blob;
+    }
+    rb.encodeNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+    rb.pushes++;
+}
+
+// What rewind_pop did
+const int REWIND_STEPPED = 0;
+const int REWIND_EMPTY = 1;  // history used up, gs stays as it is
+const int REWIND_BROKEN = 2; // the entry didn't decode to a valid state, gs untouched
+
+// Steps gs one tick back
+int rewind_pop(RewindBuffer &rb, GameState &gs)
+{
+    if (rb.count < 2)
+        return REWIND_EMPTY;
+    rb.head = rewind_entry(rb, rb.count - 1).offset;
+    rb.usedBytes -= rewind_entry(rb, rb.count - 1).size;
+    rb.count--;
+
+    int keyIndex = rb.count - 1;
+    while (!rewind_entry(rb, keyIndex).key)
+        keyIndex--;
+    const RewindEntry &key = rewind_entry(rb, keyIndex);
+    if (key.serial != rb.keySerial)
+    {
+        rb.keySerial = -1;
+        if (!rewind_decode(rb.arena.data() + key.offset, key.size, rb.largest, rb.zeros, rb.keyBlob))
+            return REWIND_BROKEN;
+        rb.keySerial = key.serial;
+    }
+    rb.sinceKey = rb.count - keyIndex;
+    rb.groupBytes = 0;
+    for (int k = keyIndex; k < rb.count; k++)
+        rb.groupBytes += rewind_entry(rb, k).size;
+
+    // keyBlob may carry zero padding from a longer delta, so a keyframe is
+    // decoded again rather than copied
+    const RewindEntry &e = rewind_entry(rb, rb.count - 1);
+    if (!rewind_decode(rb.arena.data() + e.offset, e.size, rb.largest, e.key ? rb.zeros : rb.keyBlob, rb.blob))
+        return REWIND_BROKEN;
+    return load_game_state(gs, rb.blob) ? REWIND_STEPPED : REWIND_BROKEN;
+}
+
+// Fresh run of one level: everything is reset and the RNG is seeded, so the
+// same seed and inputs always play out the same
+void newGame(GameState &gs, int level, unsigned seed)
+{
+    gs = GameState();
+    initGameState(gs, seed);
+    gs.selectedLevel = level;
+    gs.gameState = 1;
+    startLevel(gs);
+}
+
+void begin_recording(InputRecording &rec, const GameState &gs)
+{
+    rec.seed = gs.seed;
+    rec.level = gs.selectedLevel;
+    rec.tickDt = gs.tickDt;
+    rec.ticks.clear();
+    rec.finalHash = 0;
+}
+
+void end_recording(InputRecording &rec, const GameState &gs, const string &path)
+{
+    rec.finalHash = hash_game_state(gs);
+    if (save_recording(rec, path))
+        cout << "recorded " << rec.ticks.size() << " ticks (seed " << rec.seed << ") to " << path << endl;
+    else
+        cout << "could not write " << path << endl;
+}
+
+// Runs the simulation without a window as fast as the CPU allows.
+// Whenever a run ends (game over or last level cleared) the level is restarted.
+// With a record path the first run is saved for --replay.
+void runHeadless(int level, long ticks, unsigned seed, const string &recordPath)
+{
+    srand(seed);
+    GameState gs;
+    newGame(gs, level, seed);
+
+    InputSource src;
+    src.mode = INPUT_RANDOM;
+    InputRecording rec;
+    bool recording = !recordPath.empty();
+    if (recording)
+        begin_recording(rec, gs);
+
+    GameInput in;
+    long restarts = 0;
+
+    auto begin = chrono::steady_clock::now();
+    for (long t = 0; t < ticks; t++)
+    {
+        next_input(src, in);
+        if (recording)
+            rec.ticks.push_back(pack_input(in));
+
+        stepGame(gs, in);
+        gs.levelChanged = false;
+
+        if (gs.gameState == 0)
+        {
+            if (recording)
+            {
+                end_recording(rec, gs, recordPath);
+                recording = false;
+            }
+
+            restarts++;
+            gs.selectedLevel = level;
+            gs.gameState = 1;
+            startLevel(gs);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    if (recording)
+        end_recording(rec, gs, recordPath);
+
+    cout << "headless: " << ticks << " ticks in " << seconds << " s ("
+         << (seconds > 0 ? ticks / seconds : 0) << " ticks/s), " << restarts << " restarts" << endl;
+
+}
+
+// Plays a recording back without a window and checks it ends in the recorded state
+bool runReplay(const string &path)
+{
+    InputRecording rec;
+    if (!load_recording(rec, path))
+    {
+        cout << "could not read recording " << path << endl;
+        return false;
+    }
+
+    GameState gs;
+    newGame(gs, rec.level, rec.seed);
+
+    InputSource src;
+    src.mode = INPUT_PLAYBACK;
+    src.playback = &rec;
+
+    GameInput in;
+    auto begin = chrono::steady_clock::now();
+    while (next_input(src, in))
+    {
+        stepGame(gs, in);
+        gs.levelChanged = false;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    bool match = hash_game_state(gs) == rec.finalHash;
+    cout << "replay: " << rec.ticks.size() << " ticks in " << seconds << " s ("
+         << (seconds > 0 ? rec.ticks.size() / seconds : 0) << " ticks/s), "
+         << (match ? "final state matches the recording" : "final state DIFFERS from the recording") << endl;
+    return match;
+}
+
+// Batch environment for balance testing and bots: N independent games, each
+// with its own GameState (grid, enemies, RNG), stepped together with one input
+// byte per game (pack_input format) on a pool of worker threads. After every
+// step the observation arrays below describe all games; a game whose run ended
+// is reset through startLevel at once and reports why in done.
+const int BATCH_RUNNING = 0;
+const int BATCH_LOST = 1;    // lives ran out
+const int BATCH_CLEARED = 2; // every enemy gone, the victory animation finished
+
+// Bits of BatchEnv::enemyState
+const unsigned char ENEMY_OBS_RIGHT = 1;  // facing right
+const unsigned char ENEMY_OBS_HIDDEN = 2; // in the backpack
+const unsigned char ENEMY_OBS_SUCKED = 4;
+const unsigned char ENEMY_OBS_THROWN = 8;
+
+struct PlayerObs
+{
+    float x;
+    float y;
+    float velocityY;
+    float damageCooldown;
+    int lifeCount;
+    int backCount;
+    int enemiesLeft;
+    unsigned char onGround;
+    unsigned char facingRight;
+    unsigned char victory;
+};
+
+struct BatchEnv
+{
+    int level = 1;
+    vector<GameState> games;
+
+    // Observations. Every game plays the same level, so the tile flags
+    // (height x width, row-major, TILE_* bits) are shared and never change.
+    // Enemies are SoA with enemyCap entries per game, the first enemyCount[g]
+    // of game g's block are in use.
+    int width = 0;
+    int height = 0;
+    vector<unsigned char> tiles;
+    vector<PlayerObs> player;
+    int enemyCap = 0;
+    vector<int> enemyCount;
+    vector<float> enemyX;
+    vector<float> enemyY;
+    vector<unsigned char> enemyType;
+    vector<unsigned char> enemyState;
+    vector<unsigned char> done; // BATCH_* per game, for the last step only
+    long restarts = 0;
+
+    // Worker pool. Each step bumps generation, the workers and the caller
+    // claim chunks of games until none are left, the caller waits for busy to
+    // drop to 0.
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable idle;
+    unsigned generation = 0;
+    int busy = 0;
+    bool quit = false;
+    int chunk = 1;
+    atomic<int> nextGame{0};
+    const unsigned char *actions = nullptr;
+    atomic<long> stepRestarts{0};
+};
+
+void batch_observe(BatchEnv &env, int g)
+{
+    const GameState &gs = env.games[g];
+    PlayerObs &p = env.player[g];
+    p.x = gs.player_x;
+    p.y = gs.player_y;
+    p.velocityY = gs.velocityY;
+    p.damageCooldown = gs.damageCooldown;
+    p.lifeCount = gs.lifeCount;
+    p.backCount = gs.backCount;
+    p.onGround = gs.onGround;
+    p.facingRight = gs.facingRight;
+    p.victory = gs.victoryAnimation;
+
+    const EnemyStore &en = gs.enemies;
+    int n = min(enemy_count(en), env.enemyCap);
+    size_t base = (size_t)g * env.enemyCap;
+    p.enemiesLeft = enemy_count(en);
+    env.enemyCount[g] = n;
+    for (int i = 0; i < n; i++)
+    {
+        env.enemyX[base + i] = en.x[i];
+        env.enemyY[base + i] = en.y[i];
+        env.enemyType[base + i] = (unsigned char)en.type[i];
+        env.enemyState[base + i] = (en.goingRight[i] ? ENEMY_OBS_RIGHT : 0) | (en.disappeared[i] ? ENEMY_OBS_HIDDEN : 0) |
+                                   (en.sucked[i] ? ENEMY_OBS_SUCKED : 0) | (en.thrown[i] ? ENEMY_OBS_THROWN : 0);
+    }
+}
+
+// One tick of one game. Clearing the level counts as the end of the run too,
+// the game restarts the batch level instead of moving on to the next one.
+void batch_step_game(BatchEnv &env, int g)
+{
+    GameState &gs = env.games[g];
+    stepGame(gs, unpack_input(env.actions[g]));
+
+    unsigned char done = BATCH_RUNNING;
+    if (gs.gameState == 0)
+        done = gs.lifeCount < 0 ? BATCH_LOST : BATCH_CLEARED;
+    else if (gs.levelChanged)
+        done = BATCH_CLEARED;
+    gs.levelChanged = false;
+
+    if (done != BATCH_RUNNING)
+    {
+        gs.selectedLevel = env.level;
+        gs.gameState = 1;
+        startLevel(gs);
+        gs.levelChanged = false;
+        env.stepRestarts.fetch_add(1, memory_order_relaxed);
+    }
+    env.done[g] = done;
+    batch_observe(env, g);
+}
+
+void batch_run_games(BatchEnv &env)
+{
+    TRACE_ZONE("batch games");
+    const int count = (int)env.games.size();
+    while (true)
+    {
+        int first = env.nextGame.fetch_add(env.chunk);
+        if (first >= count)
+            break;
+        int last = min(first + env.chunk, count);
+        for (int g = first; g < last; g++)
+            batch_step_game(env, g);
+    }
+}
+
+void batch_worker(BatchEnv *env)
+{
+    unsigned seen = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(env->lock);
+            while (!env->quit && env->generation == seen)
+                env->wake.wait(guard);
+            if (env->quit)
+                return;
+            seen = env->generation;
+        }
+
+        batch_run_games(*env);
+
+        lock_guard<mutex> guard(env->lock);
+        if (--env->busy == 0)
+            env->idle.notify_one();
+    }
+}
+
+// Sets up games copies of the level, game g seeded with seed + g, and
+// threadCount - 1 workers (the caller of batch_step is the last one).
+// Returns false if there is no such level.
+bool batch_start(BatchEnv &env, int games, int level, unsigned seed, int threadCount)
+{
+    if (level < 1 || level > (int)levelTable.size() || games < 1)
+        return false;
+
+    env.level = level;
+    env.games.resize(games);
+    for (int g = 0; g < games; g++)
+    {
+        newGame(env.games[g], level, seed + g);
+        env.games[g].levelChanged = false;
+    }
+
+    const TileMap &lvl = env.games[0].lvl;
+    env.width = lvl.width;
+    env.height = lvl.height;
+    env.tiles = lvl.flags;
+    env.enemyCap = max(1, (int)levelTable[level - 1].spawns.size());
+    env.player.assign(games, PlayerObs());
+    env.enemyCount.assign(games, 0);
+    env.enemyX.assign((size_t)games * env.enemyCap, 0);
+    env.enemyY.assign((size_t)games * env.enemyCap, 0);
+    env.enemyType.assign((size_t)games * env.enemyCap, 0);
+    env.enemyState.assign((size_t)games * env.enemyCap, 0);
+    env.done.assign(games, BATCH_RUNNING);
+    env.restarts = 0;
+    for (int g = 0; g < games; g++)
+        batch_observe(env, g);
+
+    // Several chunks per thread so a slow game doesn't hold up the whole step
+    threadCount = max(1, threadCount);
+    env.chunk = max(1, games / (threadCount * 8));
+    env.quit = false;
+    for (int t = 1; t < threadCount; t++)
+        env.workers.push_back(thread(batch_worker, &env));
+    return true;
+}
+
+// Steps every game once with actions[g] and refreshes the observations
+void batch_step(BatchEnv &env, const unsigned char *actions)
+{
+    env.actions = actions;
+    env.nextGame.store(0);
+    env.stepRestarts.store(0);
+    {
+        lock_guard<mutex> guard(env.lock);
+        env.generation++;
+        env.busy = (int)env.workers.size();
+    }
+    env.wake.notify_all();
+
+    batch_run_games(env);
+
+    unique_lock<mutex> guard(env.lock);
+    while (env.busy > 0)
+        env.idle.wait(guard);
+    env.restarts += env.stepRestarts.load();
+}
+
+void batch_stop(BatchEnv &env)
+{
+    {
+        lock_guard<mutex> guard(env.lock);
+        env.quit = true;
+    }
+    env.wake.notify_all();
+    for (thread &worker : env.workers)
+        worker.join();
+    env.workers.clear();
+}
+
+// Steps a batch with random inputs and prints the throughput
+void runBatch(int games, long steps, int level, unsigned seed, int threadCount)
+{
+    BatchEnv env;
+    if (!batch_start(env, games, level, seed, threadCount))
+    {
+        cout << "no level " << level << endl;
+        return;
+    }
+
+    vector<unsigned char> actions(games);
+    unsigned rng = seed != 0 ? seed : 1;
+    auto begin = chrono::steady_clock::now();
+    for (long s = 0; s < steps; s++)
+    {
+        for (int g = 0; g < games; g++)
+            actions[g] = (unsigned char)(sim_rand(rng) >> 4);
+        batch_step(env, actions.data());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    batch_stop(env);
+
+    double envSteps = (double)games * steps;
+    cout << "batch: " << games << " games x " << steps << " steps on " << threadCount << " threads in " << seconds
+         << " s (" << (seconds > 0 ? envSteps / seconds : 0) << " env-steps/s), " << env.restarts << " restarts" << endl;
+}
+
+// Everything the renderer draws of one tick, copied out of the GameState by
+// the simulation thread. While a run is going the render thread never touches
+// the GameState, only the latest snapshot. Moving things carry their position
+// before the tick too (prev*), so the renderer can interpolate between them.
+struct SnapshotEnemy
+{
+    float x;
+    float y;
+    float prevX;
+    float prevY;
+    int type;
+    bool goingRight;
+    bool genovaIsAttacking;
+    int genovaAttackFrame;
+};
+
+struct RenderSnapshot
+{
+    unsigned tick = 0;
+    chrono::steady_clock::time_point tickTime; // when the tick was due on the sim thread's clock
+    int gameState = 0;
+    int selectedLevel = 1;
+    int levelSerial = 0;             // bumped every time startLevel ran
+    shared_ptr<const TileMap> tiles; // tile grid of the current level
+    float cameraX = 0;
+    float cameraY = 0;
+    float prevCameraX = 0;
+    float prevCameraY = 0;
+
+    float player_x = 0;
+    float player_y = 0;
+    float prevPlayerX = 0;
+    float prevPlayerY = 0;
+    int playerPose = POSE_RIGHT;
+    bool onGround = false;
+    bool facingRight = true;
+    bool victoryAnimation = false;
+    float victoryTimer = 0;
+    int walkframe = 0;
+    int vacuumframe = 0;
+    int lifeCount = 3;
+    GameInput input;
+
+    bool isInvisible = false;
+    bool Disappearing = false;
+    int invisDisappearFrame = 0;
+
+    vector<SnapshotEnemy> enemies; // visible ones near the view
+    vector<float> projectileX;
+    vector<float> projectileY;
+    vector<float> projectilePrevX;
+    vector<float> projectilePrevY;
+};
+
+// How far the frame being drawn is from the snapshot's previous tick to its
+// current one, 0..1. Drawing up to a tick behind the simulation buys smooth
+// motion on displays faster than the tick rate.
+float snapshot_alpha(const RenderSnapshot &snap, float tickDt)
+{
+    float t = chrono::duration<float>(chrono::steady_clock::now() - snap.tickTime).count() / tickDt;
+    return max(0.0f, min(t, 1.0f));
+}
+
+float interpolate(float from, float to, float alpha)
+{
+    return from + (to - from) * alpha;
+}
+
+// Lock-free triple buffer: the writer fills its own slot and swaps it with the
+// spare one, the reader swaps its slot with the spare one when that holds a
+// newer snapshot. Neither side ever waits and the reader always gets the
+// latest complete snapshot. The vectors in the slots keep their capacity, so
+// after a few ticks publishing no longer allocates.
+const int SNAPSHOT_FRESH = 4; // flag next to the spare slot index
+
+struct SnapshotBuffer
+{
+    RenderSnapshot slots[3];
+    atomic<int> spare{1};
+    int writing = 0; // writer's slot
+    int reading = 2; // reader's slot
+};
+
+// Only while neither thread is using the buffer
+void snapshot_reset(SnapshotBuffer &buf)
+{
+    buf.spare.store(1);
+    buf.writing = 0;
+    buf.reading = 2;
+    for (RenderSnapshot &s : buf.slots)
+    {
+        s.gameState = 0;
+        s.tiles.reset();
+    }
+}
+
+void snapshot_publish(SnapshotBuffer &buf)
+{
+    buf.writing = buf.spare.exchange(buf.writing | SNAPSHOT_FRESH, memory_order_acq_rel) & 3;
+}
+
+// Returns false (and keeps the current slot) when nothing newer was published
+bool snapshot_acquire(SnapshotBuffer &buf)
+{
+    if (!(buf.spare.load(memory_order_acquire) & SNAPSHOT_FRESH))
+        return false;
+    buf.reading = buf.spare.exchange(buf.reading, memory_order_acq_rel) & 3;
+    return true;
+}
+
+// Positions before the tick being stepped, kept by the simulation thread for
+// the prev* fields of the next snapshot. Enemies are kept by handle slot and
+// projectiles by pool slot, so they still match after removals.
+struct TickHistory
+{
+    unsigned stamp = 0; // bumped by every remember_positions
+    int levelSerial = 0;
+    float playerX = 0;
+    float playerY = 0;
+    float cameraX = 0;
+    float cameraY = 0;
+    vector<float> enemyX;
+    vector<float> enemyY;
+    vector<unsigned> enemyGen;
+    vector<unsigned> enemySeen; // stamp of the last capture that saw the slot's enemy on screen
+    vector<float> projectileX;
+    vector<float> projectileY;
+    vector<char> projectileActive;
+};
+
+void remember_positions(TickHistory &hist, const GameState &gs, int levelSerial, float viewW, float viewH)
+{
+    hist.stamp++;
+    hist.levelSerial = levelSerial;
+    hist.playerX = gs.player_x;
+    hist.playerY = gs.player_y;
+    View camera = camera_view(gs, viewW, viewH);
+    hist.cameraX = camera.getCenter().x;
+    hist.cameraY = camera.getCenter().y;
+
+    const EnemyStore &en = gs.enemies;
+    size_t slots = en.slotGen.size();
+    if (hist.enemyX.size() < slots)
+    {
+        hist.enemyX.resize(slots);
+        hist.enemyY.resize(slots);
+        hist.enemyGen.resize(slots);
+        hist.enemySeen.resize(slots, 0);
+    }
+    for (int i = 0; i < enemy_count(en); i++)
+    {
+        // Hidden in the backpack, a throw makes it reappear somewhere else
+        if (en.disappeared[i])
+            continue;
+        int slot = en.denseSlot[i];
+        hist.enemyX[slot] = en.x[i];
+        hist.enemyY[slot] = en.y[i];
+        hist.enemyGen[slot] = en.slotGen[slot];
+        hist.enemySeen[slot] = hist.stamp;
+    }
+
+    const ProjectilePool &pool = gs.projectiles;
+    hist.projectileX = pool.x;
+    hist.projectileY = pool.y;
+    hist.projectileActive = pool.active;
+}
+
+// Copies what the renderer needs into snap. Enemies and projectiles are culled
+// to the camera here, through the enemy grid the render thread can't use.
+// Anything hist doesn't know from right before this tick (new, reappeared, or
+// the level changed) gets its current position as the previous one too.
+void fill_snapshot(RenderSnapshot &snap, GameState &gs, const TickHistory &hist,
+                   const shared_ptr<const TileMap> &tiles, int levelSerial, float viewW, float viewH,
+                   chrono::steady_clock::time_point tickTime)
+{
+    bool history = hist.stamp > 0 && hist.levelSerial == levelSerial;
+    snap.tick = gs.tick;
+    snap.tickTime = tickTime;
+    snap.gameState = gs.gameState;
+    snap.selectedLevel = gs.selectedLevel;
+    snap.levelSerial = levelSerial;
+    if (snap.tiles != tiles)
+        snap.tiles = tiles;
+
+    View camera = camera_view(gs, viewW, viewH);
+    snap.cameraX = camera.getCenter().x;
+    snap.cameraY = camera.getCenter().y;
+    snap.prevCameraX = history ? hist.cameraX : snap.cameraX;
+    snap.prevCameraY = history ? hist.cameraY : snap.cameraY;
+
+    snap.player_x = gs.player_x;
+    snap.player_y = gs.player_y;
+    snap.prevPlayerX = history ? hist.playerX : gs.player_x;
+    snap.prevPlayerY = history ? hist.playerY : gs.player_y;
+    snap.playerPose = gs.playerPose;
+    snap.onGround = gs.onGround;
+    snap.facingRight = gs.facingRight;
+    snap.victoryAnimation = gs.victoryAnimation;
+    snap.victoryTimer = gs.victoryTimer;
+    snap.walkframe = gs.walkframe;
+    snap.vacuumframe = gs.vacuumframe;
+    snap.lifeCount = gs.lifeCount;
+    snap.input = gs.input;
+    snap.isInvisible = gs.isInvisible;
+    snap.Disappearing = gs.Disappearing;
+    snap.invisDisappearFrame = gs.invisDisappearFrame;
+
+    const EnemyStore &en = gs.enemies;
+    float viewLeft = snap.cameraX - viewW / 2;
+    float viewTop = snap.cameraY - viewH / 2;
+    grid_query_box(gs.enemyGrid, en, viewLeft - 128, viewTop - 128, viewLeft + viewW + 128, viewTop + viewH + 128,
+                   gs.nearbyEnemies);
+    snap.enemies.clear();
+    for (int i : gs.nearbyEnemies)
+    {
+        if (en.disappeared[i])
+            continue;
+        SnapshotEnemy e;
+        e.x = en.x[i];
+        e.y = en.y[i];
+        int slot = en.denseSlot[i];
+        bool known = history && slot < (int)hist.enemySeen.size() && hist.enemySeen[slot] == hist.stamp &&
+                     hist.enemyGen[slot] == en.slotGen[slot];
+        e.prevX = known ? hist.enemyX[slot] : e.x;
+        e.prevY = known ? hist.enemyY[slot] : e.y;
+        e.type = en.type[i];
+        e.goingRight = en.goingRight[i];
+        e.genovaIsAttacking = en.cold[i].genovaIsAttacking;
+        e.genovaAttackFrame = en.cold[i].genovaAttackFrame;
+        snap.enemies.push_back(e);
+    }
+
+    const ProjectilePool &pool = gs.projectiles;
+    snap.projectileX.clear();
+    snap.projectileY.clear();
+    snap.projectilePrevX.clear();
+    snap.projectilePrevY.clear();
+    for (int s = 0; s < (int)pool.active.size(); s++)
+    {
+        if (!pool.active[s])
+            continue;
+        // A slot freed by an earlier tick is inactive in hist, so a new fireball never
+        // inherits an old one's position
+        bool known = history && s < (int)hist.projectileActive.size() && hist.projectileActive[s];
+        snap.projectileX.push_back(pool.x[s]);
+        snap.projectileY.push_back(pool.y[s]);
+        snap.projectilePrevX.push_back(known ? hist.projectileX[s] : pool.x[s]);
+        snap.projectilePrevY.push_back(known ? hist.projectileY[s] : pool.y[s]);
+    }
+}
+
+// The simulation of one run on its own thread. It owns the GameState, the
+// input source and the recording from start_sim_thread until stop_sim_thread
+// returns; the render thread only reads the snapshots it publishes.
+struct SimThread
+{
+    thread worker;
+    atomic<bool> stop{false};
+    SnapshotBuffer snapshots;
+    float viewW = 0;
+    float viewH = 0;
+    int maxTicksBehind = 5; // catch-up limit, anything beyond is dropped
+    // F6/F7 from the render thread, served between two ticks
+    atomic<bool> saveRequested{false};
+    atomic<bool> loadRequested{false};
+    atomic<bool> rewinding{false};     // R held
+    bool allowJumps = true;            // quick-load and rewind, off while recording as they'd break the replay
+    vector<unsigned char> quickSave;   // sim thread's while it runs
+    RewindBuffer rewind;               // likewise
+};
+
+// Quick-save and quick-load on the sim thread, so gs is never touched mid-tick.
+// Returns true when a state was loaded.
+bool serve_state_requests(SimThread &sim, GameState &gs)
+{
+    if (sim.saveRequested.exchange(false, memory_order_acq_rel))
+    {
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        save_game_state(gs, sim.quickSave);
+        cout << "saved state: " << sim.quickSave.size() << " bytes, "
+             << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count() << " us" << endl;
+    }
+    if (sim.loadRequested.exchange(false, memory_order_acq_rel))
+    {
+        if (!sim.allowJumps || sim.quickSave.empty())
+            return false;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        if (!load_game_state(gs, sim.quickSave))
+        {
+            // Can't happen for a blob from this run; gs is untouched, play on
+            cout << "quick-load failed, save state rejected" << endl;
+            return false;
+        }
+        // The rewind history belongs to the abandoned timeline
+        rewind_clear(sim.rewind);
+        rewind_push(sim.rewind, gs);
+        cout << "loaded state: " << sim.quickSave.size() << " bytes, "
+             << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count() << " us" << endl;
+        return true;
+    }
+    return false;
+}
+
+void sim_thread_run(SimThread &sim, GameState &gs, InputSource &input, InputRecording *recording)
+{
+    TRACE_ZONE("sim thread");
+    shared_ptr<const TileMap> tiles;
+    int levelSerial = 0;
+    TickHistory history;
+    const chrono::steady_clock::duration tickTime =
+        chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(gs.tickDt));
+    chrono::steady_clock::time_point next = chrono::steady_clock::now();
+    if (sim.allowJumps)
+        rewind_push(sim.rewind, gs);
+
+    while (true)
+    {
+        // Nothing to interpolate across a quick-load, the loaded tick is its own previous one
+        if (serve_state_requests(sim, gs))
+            remember_positions(history, gs, levelSerial, sim.viewW, sim.viewH);
+        // startLevel ran or a state was loaded, hand the renderer a copy of the new grid
+        if (gs.levelChanged)
+        {
+            tiles = make_shared<const TileMap>(gs.lvl);
+            levelSerial++;
+            gs.levelChanged = false;
+        }
+        fill_snapshot(sim.snapshots.slots[sim.snapshots.writing], gs, history, tiles, levelSerial, sim.viewW, sim.viewH,
+                      next);
+        snapshot_publish(sim.snapshots);
+
+        if (gs.gameState != 1 || sim.stop.load(memory_order_acquire))
+            break;
+
+        // Fixed ticks on the wall clock. After a long stall (debugger, suspended
+        // machine) the backlog beyond maxTicksBehind ticks is dropped.
+        next += tickTime;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (now - next > tickTime * sim.maxTicksBehind)
+            next = now;
+        else if (next > now)
+            sf::sleep(microseconds(chrono::duration_cast<chrono::microseconds>(next - now).count()));
+
+        // Holding R plays the history back one tick per tick; once it runs out
+        // the game stands still until R is released
+        if (sim.allowJumps && sim.rewinding.load(memory_order_acquire))
+        {
+            ProfScope scope(PROF_REWIND);
+            remember_positions(history, gs, levelSerial, sim.viewW, sim.viewH);
+            if (rewind_pop(sim.rewind, gs) == REWIND_BROKEN)
+            {
+                // The history is damaged, so nothing older can be trusted;
+                // start the level over rather than keep rewinding into it
+                cout << "rewind failed, history rejected; restarting the level" << endl;
+                newGame(gs, gs.selectedLevel, gs.seed);
+                rewind_clear(sim.rewind);
+                rewind_push(sim.rewind, gs);
+            }
+            continue;
+        }
+
+        GameInput in;
+        {
+            ProfScope scope(PROF_INPUT);
+            next_input(input, in);
+        }
+        if (recording)
+            recording->ticks.push_back(pack_input(in));
+        remember_positions(history, gs, levelSerial, sim.viewW, sim.viewH);
+        stepGame(gs, in);
+        if (sim.allowJumps)
+        {
+            ProfScope scope(PROF_REWIND);
+            rewind_push(sim.rewind, gs);
+        }
+    }
+
+    const RewindBuffer &rb = sim.rewind;
+    if (rb.pushes > 0)
+    {
+        cout << "rewind: " << rb.count * gs.tickDt << " s kept in " << rb.usedBytes / 1024 << " of "
+             << rb.arena.size() / 1024 << " KB, " << rb.encodeNs / rb.pushes / 1000.0 << " us per tick" << endl;
+        if (rb.earlyDrops > 0)
+            cout << "rewind: the " << rb.arena.size() / 1024 << " KB arena filled before " << REWIND_SECONDS
+                 << " s were kept, " << rb.earlyDrops << " keyframe groups dropped early" << endl;
+    }
+}
+
+void start_sim_thread(SimThread &sim, GameState &gs, InputSource &input, InputRecording *recording)
+{
+    snapshot_reset(sim.snapshots);
+    sim.stop.store(false);
+    sim.saveRequested.store(false);
+    sim.loadRequested.store(false);
+    sim.rewinding.store(false);
+    sim.allowJumps = recording == nullptr;
+    if (sim.allowJumps)
+        rewind_init(sim.rewind, gs.tickDt);
+    sim.worker = thread(sim_thread_run, ref(sim), ref(gs), ref(input), recording);
+}
+
+// Waits for the simulation thread to finish; the GameState is the caller's again
+void stop_sim_thread(SimThread &sim)
+{
+    sim.stop.store(true, memory_order_release);
+    if (sim.worker.joinable())
+        sim.worker.join();
+}
+
+// bench.cpp includes this file for everything but main
+#ifndef TUMBLEPOP_NO_MAIN
+int main(int argc, char *argv[])
+{
+    chrono::steady_clock::time_point launchTime = chrono::steady_clock::now();
+    srand(time(NULL));
+
+    // tumblepop --compile-level in.txt out.lvl
+    if (argc > 3 && string(argv[1]) == "--compile-level")
+    {
+        LevelData ld;
+        if (!load_level(argv[2], ld))
+            return 1;
+        if (!save_level_binary(ld, argv[3]))
+        {
+            cout << "could not write " << argv[3] << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (load_level_set(levelDir, levelTable) == 0)
+    {
+        cout << "No levels found in " << levelDir << endl;
+        return 1;
+    }
+
+    // tumblepop --replay file
+    if (argc > 2 && string(argv[1]) == "--replay")
+    {
+        bool match = runReplay(argv[2]);
+#ifdef TUMBLEPOP_TRACE
+        trace_write("trace.json");
+#endif
+        return match ? 0 : 1;
+    }
+
+    // tumblepop --headless [ticks] [level] [--seed n] [--record file]
+    if (argc > 1 && string(argv[1]) == "--headless")
+    {
+        long ticks = 100000;
+        int level = 1;
+        unsigned seed = (unsigned)time(NULL);
+        string recordPath;
+        int positional = 0;
+        for (int a = 2; a < argc; a++)
+        {
+            string arg = argv[a];
+            if (arg == "--seed" && a + 1 < argc)
+                seed = (unsigned)strtoul(argv[++a], nullptr, 10);
+            else if (arg == "--record" && a + 1 < argc)
+                recordPath = argv[++a];
+            else if (positional++ == 0)
+                ticks = atol(argv[a]);
+            else
+                level = atoi(argv[a]);
+        }
+        if (level < 1 || level > (int)levelTable.size())
+            level = 1;
+        runHeadless(level, ticks, seed, recordPath);
+#ifdef TUMBLEPOP_TRACE
+        trace_write("trace.json");
+#endif
+        return 0;
+    }
+
+    // tumblepop --batch [games] [steps] [level] [--threads n] [--seed n]
+    if (argc > 1 && string(argv[1]) == "--batch")
+    {
+        int games = 256;
+        long steps = 2000;
+        int level = 1;
+        unsigned seed = (unsigned)time(NULL);
+        int threadCount = max(1, (int)thread::hardware_concurrency());
+        int positional = 0;
+        for (int a = 2; a < argc; a++)
+        {
+            string arg = argv[a];
+            if (arg == "--threads" && a + 1 < argc)
+                threadCount = max(1, atoi(argv[++a]));
+            else if (arg == "--seed" && a + 1 < argc)
+                seed = (unsigned)strtoul(argv[++a], nullptr, 10);
+            else
+            {
+                if (positional == 0)
+                    games = max(1, atoi(argv[a]));
+                else if (positional == 1)
+                    steps = atol(argv[a]);
+                else
+                    level = atoi(argv[a]);
+                positional++;
+            }
+        }
+        runBatch(games, steps, level, seed, threadCount);
+#ifdef TUMBLEPOP_TRACE
+        trace_write("trace.json");
+#endif
+        return 0;
+    }
+
+    // tumblepop [--maxticks n] [--record file]
+    int maxTicksPerFrame = 5; // catch-up limit, anything beyond is dropped
+    string recordPath;
+    for (int a = 1; a + 1 < argc; a++)
+    {
+        if (string(argv[a]) == "--maxticks")
+            maxTicksPerFrame = max(1, atoi(argv[++a]));
+        else if (string(argv[a]) == "--record")
+            recordPath = argv[++a];
+    }
+
+    // The display rate no longer drives the game, vsync only paces rendering
+    RenderWindow window(VideoMode(screen_x, screen_y), "Tumble-POP", Style::Resize);
+    window.setVerticalSyncEnabled(true);
+
+    GameState gs;
+    initGameState(gs, (unsigned)rand());
+
+    // Each run started from the menu is recorded when --record is given
+    InputSource liveInput;
+    InputRecording recording;
+    bool recordingRun = false;
+
+    profiler.enabled = true;
+
+    const int cell_size = gs.cell_size;
+
+    float player_x = gs.player_x;
+    float player_y = gs.player_y;
+
+    sf::Color darkBlue(200, 0, 10, 255);
+    sf::Color lightWhite(0, 0, 0);
+    Font font;
+    bool fontLoaded = font.loadFromFile("Data/arialbd.ttf");
+    if (!fontLoaded)
+        cout << "Failed to load font" << endl;
+
+    // Screen-sized images stay standalone textures in the cache, level backgrounds included
+    vector<string> standaloneFiles = {"Data/tumblebg.jpg", "Data/logo.png"};
+    for (const LevelData &ld : levelTable)
+    {
+        if (find(standaloneFiles.begin(), standaloneFiles.end(), ld.background) == standaloneFiles.end())
+            standaloneFiles.push_back(ld.background);
+    }
+    const int standaloneCount = (int)standaloneFiles.size();
+
+    // Every small sprite image is packed into shared atlas pages
+    vector<string> atlasFiles;
+    for (int i = 0; i < 6; i++)
+        atlasFiles.push_back("Data/invisible/getinvisible_" + to_string(i) + ".png");
+    for (int i = 0; i < 16; i++)
+        atlasFiles.push_back("Data/vacuum/" + to_string(i + 1) + ".png");
+    for (int i = 0; i < 8; i++)
+        atlasFiles.push_back("Data/walk/" + to_string(i) + ".png");
+    for (int i = 0; i < 4; i++)
+        atlasFiles.push_back("Data/victory/" + to_string(i) + ".png");
+    for (int i = 0; i < 4; i++)
+        atlasFiles.push_back("Data/Genova/fireball/" + to_string(i + 1) + ".png");
+    for (int i = 0; i < 6; i++)
+        atlasFiles.push_back("Data/Genova/Genova_throw/" + to_string(i + 1) + ".png");
+    const char *singleFiles[] = {"Data/heart.png", "Data/player_logo.png", "Data/player_num.png",
+                                 "Data/Genova/genova_left.png", "Data/Genova/genova_right.png",
+                                 "Data/Ghost/ghost_left.png", "Data/Ghost/ghost_right.png",
+                                 "Data/Skeleton/skeleton_left.png", "Data/Skeleton/skeleton_right.png",
+                                 "Data/invisible/iman_left.png", "Data/invisible/iman_right.png",
+                                 "Data/jump_right.png", "Data/jump_left.png",
+                                 "Data/player_right.png", "Data/player_left.png", "Data/player_up.png", "Data/player_down.png"};
+    for (const char *file : singleFiles)
+        atlasFiles.push_back(file);
+    // Tilesets named by the level files. Ones added by a later F5 reload aren't packed until restart.
+    for (const LevelData &ld : levelTable)
+    {
+        for (int k = 0; k < TILE_KINDS; k++)
+        {
+            if (!ld.tileset[k].empty() && find(atlasFiles.begin(), atlasFiles.end(), ld.tileset[k]) == atlasFiles.end())
+                atlasFiles.push_back(ld.tileset[k]);
+        }
+    }
+
+    // Decode everything on a worker pool while the window shows a loading bar
+    vector<string> loadFiles = standaloneFiles;
+    loadFiles.insert(loadFiles.end(), atlasFiles.begin(), atlasFiles.end());
+
+    int decodeThreads = max(1, (int)thread::hardware_concurrency());
+    chrono::steady_clock::time_point decodeStart = chrono::steady_clock::now();
+    AssetLoader loader;
+    start_asset_loader(loader, loadFiles, decodeThreads);
+
+    Text loadingText;
+    loadingText.setFont(font);
+    loadingText.setCharacterSize(24);
+    loadingText.setFillColor(Color::White);
+    loadingText.setPosition(screen_x / 2 - 200, screen_y / 2 - 60);
+
+    bool firstFrameShown = false;
+    while (loader.done.load() < (int)loadFiles.size() && window.isOpen())
+    {
+        Event loadEv;
+        while (window.pollEvent(loadEv))
+        {
+            if (loadEv.type == Event::Closed)
+                window.close();
+        }
+
+        int done = loader.done.load();
+        window.clear(Color::Black);
+
+        RectangleShape barBack(Vector2f(400, 30));
+        barBack.setPosition(screen_x / 2 - 200, screen_y / 2);
+        barBack.setFillColor(Color(60, 60, 60));
+        prof_draw(window, barBack);
+
+        RectangleShape bar(Vector2f(400.0f * done / loadFiles.size(), 30));
+        bar.setPosition(screen_x / 2 - 200, screen_y / 2);
+        bar.setFillColor(darkBlue);
+        prof_draw(window, bar);
+
+        if (fontLoaded)
+        {
+            loadingText.setString("Loading " + to_string(done) + " / " + to_string(loadFiles.size()));
+            prof_draw(window, loadingText);
+        }
+
+        window.display();
+        prof_end_frame();
+        if (!firstFrameShown)
+        {
+            cout << "first frame (loading screen) after "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - launchTime).count() << " ms" << endl;
+            firstFrameShown = true;
+        }
+    }
+    finish_asset_loader(loader);
+    cout << "decoded " << loadFiles.size() << " images on " << decodeThreads << " threads in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - decodeStart).count() << " ms" << endl;
+
+    // Uploads happen here on the render thread
+    ResourceCache cache;
+    for (int i = 0; i < standaloneCount; i++)
+    {
+        if (loader.ok[i])
+            cache_decoded_image(cache, loadFiles[i], loader.hashes[i], loader.images[i]);
+    }
+
+    TextureAtlas atlas;
+    build_atlas(atlas, atlasFiles,
+                vector<Image>(loader.images.begin() + standaloneCount, loader.images.end()),
+                vector<char>(loader.ok.begin() + standaloneCount, loader.ok.end()),
+                min(Texture::getMaximumSize(), 512u));
+
+    // Decoded pixels are on the GPU now
+    loader.images.clear();
+
+    Sprite bgmenusprite;
+    bgmenusprite.setTexture(*get_texture(cache, "Data/tumblebg.jpg")); // bg load
+    bgmenusprite.setPosition(0, 0);
+
+    const Texture *logoTex = get_texture(cache, "Data/logo.png"); // logo load
+    Sprite logoSprite;
+
+    Sprite bgSprite;
+
+    AtlasFrame Disappear[6];
+    Sprite Disappear_spr[6];
+
+    // Static tile geometry, rebuilt whenever startLevel changes the grid
+    TileChunks tileChunks;
+    LevelCache levelCache;
+    AtlasFrame tileFrames[TILE_KINDS];
+
+    AtlasFrame rainbow_frame[16];
+    Sprite rainbow_sprite[16];
+    AtlasFrame heartFrame = atlas_frame(atlas, "Data/heart.png");
+    Sprite heartSpr[3];
+    AtlasFrame walk_frame[8];
+    Sprite walk_sprite[8];
+    AtlasFrame victoryFrameRect[4];
+    Sprite victorySpr[4];
+    Sprite playerLogoSpr;
+    Sprite playerNumSpr;
+
+    for (int i = 0; i < 6; i++)
+    {
+        Disappear[i] = atlas_frame(atlas, "Data/invisible/getinvisible_" + to_string(i) + ".png");
+        set_atlas_frame(Disappear_spr[i], atlas, Disappear[i]);
+        Disappear_spr[i].setScale(1.8, 1.8);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        rainbow_frame[i] = atlas_frame(atlas, "Data/vacuum/" + to_string(i + 1) + ".png");
+        set_atlas_frame(rainbow_sprite[i], atlas, rainbow_frame[i]);
+        rainbow_sprite[i].setPosition(player_x, player_y);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        set_atlas_frame(heartSpr[i], atlas, heartFrame);
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        walk_frame[i] = atlas_frame(atlas, "Data/walk/" + to_string(i) + ".png");
+        set_atlas_frame(walk_sprite[i], atlas, walk_frame[i]);
+        walk_sprite[i].setPosition(player_x, player_y);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        victoryFrameRect[i] = atlas_frame(atlas, "Data/victory/" + to_string(i) + ".png");
+        set_atlas_frame(victorySpr[i], atlas, victoryFrameRect[i]);
+        victorySpr[i].setPosition(player_x, player_y);
+    }
+
+    set_atlas_frame(playerLogoSpr, atlas, atlas_frame(atlas, "Data/player_logo.png"));
+    playerLogoSpr.setScale(1.5, 1.5);
+    playerLogoSpr.setPosition(8, 8);
+
+    set_atlas_frame(playerNumSpr, atlas, atlas_frame(atlas, "Data/player_num.png"));
+    playerNumSpr.setScale(2.5, 2.5);
+    playerNumSpr.setPosition(64, 12);
+
+    Music lvlMusic;
+    if (!lvlMusic.openFromFile("Data/mus.ogg"))
+        cout << "Failed to load mus.ogg" << endl;
+    lvlMusic.setVolume(20);
+
+    AtlasFrame PlayerFrameRight = atlas_frame(atlas, "Data/player_right.png");
+    AtlasFrame PlayerFrameLeft = atlas_frame(atlas, "Data/player_left.png");
+    AtlasFrame PlayerFrameUp = atlas_frame(atlas, "Data/player_up.png");
+    AtlasFrame PlayerFrameDown = atlas_frame(atlas, "Data/player_down.png");
+    AtlasFrame PlayerFrameJumpRight = atlas_frame(atlas, "Data/jump_right.png");
+    AtlasFrame PlayerFrameJumpLeft = atlas_frame(atlas, "Data/jump_left.png");
+    Sprite PlayerSprite;
+
+    // Genova Data
+    AtlasFrame genovaLeftFrame = atlas_frame(atlas, "Data/Genova/genova_left.png");
+    AtlasFrame genovaRightFrame = atlas_frame(atlas, "Data/Genova/genova_right.png");
+    Sprite genovaSpr;
+
+    genovaSpr.setScale(1.8, 1.8);
+
+    // Start facing right
+    set_atlas_frame(genovaSpr, atlas, genovaRightFrame);
 
-                // Level 2: disable slot 0 (user requested special handling for level 2)
-                if (selectedLevel == 2)
-                {
-                    enemyDisappeared[0] = true;
-                }
+    // fire ball, every projectile in the pool is drawn from these in one batch
+    AtlasFrame fireballFrames[4];
+    VertexArray projectileBatch;
 
-                // Stuck detection: if an enemy hasn't moved for a while, relocate (especially ghosts)
-                for (int i = 0; i < MAX_ENEMIES; ++i)
-                {
-                    if (enemyDisappeared[i] || enemySucked[i])
-                        continue;
-                    float dx = fabs(enemyX[i] - enemyPrevX[i]);
-                    float dy = fabs(enemyY[i] - enemyPrevY[i]);
-                    if (dx < 1.0f && dy < 1.0f)
-                    {
-                        enemyStuckFrames[i] += 1;
-                    }
-                    else
-                    {
-                        enemyStuckFrames[i] = 0;
-                    }
+    for (int i = 0; i < 4; i++)
+        fireballFrames[i] = atlas_frame(atlas, "Data/Genova/fireball/" + to_string(i + 1) + ".png");
 
-                    // update previous position for next frame
-                    enemyPrevX[i] = enemyX[i];
-                    enemyPrevY[i] = enemyY[i];
+    Sprite genova_sprite[6]; // for genova attack
 
-                    // If stuck for >30 frames (~0.5s), relocate ghosts to a valid nearby spawn
-                    if (enemyStuckFrames[i] > 30)
-                    {
-                        if (enemyTypes[i] == 0)
-                        {
-                            int sc = (int)(enemyX[i] / cell_size);
-                            int sr = (int)(enemyY[i] / cell_size);
-                            findValidSpawn(lvl, sr, sc, enemyTypes[i], height, width);
-                            enemyX[i] = sc * cell_size;
-                            enemyY[i] = sr * cell_size;
-                        }
-                        enemyStuckFrames[i] = 0;
-                    }
-                }
-            }
+    for (int i = 0; i < 6; i++)
+    {
+        set_atlas_frame(genova_sprite[i], atlas, atlas_frame(atlas, "Data/Genova/Genova_throw/" + to_string(i + 1) + ".png"));
+        genova_sprite[i].setScale(1.8, 1.8);
+    }
 
-            for (int i = 0; i < MAX_ENEMIES; i++)
-            {
-                if (enemyDisappeared[i])
-                    continue;
+    // Ghost data
+    AtlasFrame ghostLeftFrame = atlas_frame(atlas, "Data/Ghost/ghost_left.png");
+    AtlasFrame ghostRightFrame = atlas_frame(atlas, "Data/Ghost/ghost_right.png");
+    Sprite ghostSpr;
 
-                if (enemyTypes[i] == 0)
-                { // Ghost
-                    // Ensure correct facing per enemy
-                    if (enemyGoingRight[i])
-                        ghostSpr.setTexture(ghostRightTex);
-                    else
-                        ghostSpr.setTexture(ghostLeftTex);
+    ghostSpr.setScale(1.8, 1.8);
+    set_atlas_frame(ghostSpr, atlas, ghostRightFrame);
 
-                    ghostSpr.setPosition(enemyX[i], enemyY[i]);
-                    drawGhost(window, ghostSpr);
-                    // (debug index removed)
-                }
-                else if (enemyTypes[i] == 1)
-                { // Skeleton
-                    // Use per-enemy direction for texture
-                    if (enemyGoingRight[i])
-                        skelSpr.setTexture(skelRightTex);
-                    else
-                        skelSpr.setTexture(skelLeftTex);
+    // skeleton data
+    AtlasFrame skelLeftFrame = atlas_frame(atlas, "Data/Skeleton/skeleton_left.png");
+    AtlasFrame skelRightFrame = atlas_frame(atlas, "Data/Skeleton/skeleton_right.png");
+    Sprite skelSpr;
 
-                    skelSpr.setPosition(enemyX[i], enemyY[i]);
-                    drawskel(window, skelSpr);
-                    // (debug index removed)
-                }
-                else if (enemyTypes[i] == 2)
-                { // Invisible Man
-                    // Invisible man uses its own appearing logic; ensure texture matches direction
-                    if (enemyGoingRight[i])
-                        invisSpr.setTexture(invisRightTex);
-                    else
-                        invisSpr.setTexture(invisLeftTex);
+    skelSpr.setScale(1.8, 1.8);
+    set_atlas_frame(skelSpr, atlas, skelRightFrame);
 
-                    invisSpr.setPosition(enemyX[i], enemyY[i]);
-                    drawinvisibleman(window, invisSpr, isInvisible, Disappearing,
-                                     invisDisappearFrame, Disappear_spr);
-                }
-                else if (enemyTypes[i] == 3)
-                { // Genova
-                    // Use per-enemy direction rather than the single global
-                    bool facing = enemyGoingRight[i];
-                    if (facing)
-                        genovaSpr.setTexture(genovaRightTex);
-                    else
-                        genovaSpr.setTexture(genovaLeftTex);
-
-                    genovaSpr.setPosition(enemyX[i], enemyY[i]);
-                    // decrement per-enemy fireball cooldown (frames)
-                    if (fireballCooldownArr[i] > 0)
-                        fireballCooldownArr[i] -= 1;
-                    // Draw and manage fireball using per-enemy state arrays
-                    drawGenova(window, genovaSpr, genovaIsAttackingArr[i], facing,
-                               genovaAttackFrameArr[i], player_x, player_y, fireballCooldownArr[i],
-                               fireballSpawnedArr[i], genova_sprite, fire_sprite, enemyX[i],
-                               enemyY[i], vacuumframe, fireballActiveArr[i], fireballXArr[i], fireballYArr[i],
-                               fireballRightArr[i], fireballSpeed, fireballHitArr[i], lifeCount, damageCooldown, vacuum);
-                }
-            }
+    // invisible man data
+    AtlasFrame invisLeftFrame = atlas_frame(atlas, "Data/invisible/iman_left.png");
+    AtlasFrame invisRightFrame = atlas_frame(atlas, "Data/invisible/iman_right.png");
+    Sprite invisSpr;
 
-            if (vacuum && !victoryAnimation)
-            {
-                for (int i = 0; i < 4; i++) // loop for vacum animation 
-                {
-                    if (facingRight)
-                    {
-                        window.draw(rainbow_sprite[(vacuumframe / 5) + 4]);
-                        rainbow_sprite[i + 4].setPosition(player_x + 60, player_y + 25);
-                    }
-                    else if (pressingUp)
-                    {
-                        window.draw(rainbow_sprite[(vacuumframe / 5) + 8]);
-                        rainbow_sprite[i + 8].setPosition(player_x - 5, player_y - 53);
-                    }
-                    else if (pressingDown)
-                    {
-                        window.draw(rainbow_sprite[(vacuumframe / 5) + 12]);
-                        rainbow_sprite[i + 12].setPosition(player_x - 2, player_y + 69);
-                    }
-                    else
-                    {
-                        window.draw(rainbow_sprite[vacuumframe / 5]);
-                        rainbow_sprite[i].setPosition(player_x - 50, player_y + 25);
-                    }
-                }
-                
-                for (int i = 0; i < MAX_ENEMIES; i++)
-                {
-                    if (enemyDisappeared[i] || enemySucked[i])
-                        continue;
-                    
-                    bool suctionRangeX;
-                    bool suctionRangeY;
+    invisSpr.setScale(1.8, 1.8);
+    set_atlas_frame(invisSpr, atlas, invisRightFrame);
 
-                    if (pressingUp || pressingDown)
-                    {
-                        suctionRangeX = enemyX[i] >= (player_x - 150) && enemyX[i] <= (player_x + 150);
-                        suctionRangeY = enemyY[i] >= (player_y - 32) && enemyY[i] <= (player_y + 32);
-                    }
-                    else
-                    {
-                        suctionRangeX = enemyX[i] >= (player_x - 100) && enemyX[i] <= (player_x + 100);
-                        suctionRangeY = enemyY[i] >= (player_y - 100) && enemyY[i] <= (player_y + 100);
-                    }
+    set_atlas_frame(PlayerSprite, atlas, PlayerFrameRight);
+    PlayerSprite.setScale(2, 2);
+    PlayerSprite.setPosition(player_x, player_y);
+
+    Event ev;
 
-                    if (!suctionRangeX || !suctionRangeY)
-                        continue;
+    bool spacePressed = false;
+    bool escapePressed = false;
 
-                    // If Genova is currently attacking, vacuum has no effect on it
-                    if (enemyTypes[i] == 3 && genovaIsAttackingArr[i])
-                        continue;
+    Text titleText;
+    titleText.setFont(font);
+    Text levelText[2]; // the menu lists two levels at a time
+    levelText[0].setFont(font);
+    levelText[1].setFont(font);
+    Text instructText;
+    instructText.setFont(font);
 
-                    // Horizontal suction (left/right)
-                    if (!pressingUp && !pressingDown && ((backCountLevel1 < 3 && selectedLevel == 1) || (backCountLevel2 < 5 && selectedLevel == 2)))
-                    {
-                        if (facingRight && ((backCountLevel1 < 3 && selectedLevel == 1) || (backCountLevel2 < 5 && selectedLevel == 2)))
-                        {
-                            if (enemyX[i] >= player_x && suctionRangeX && suctionRangeY)
-                            {
-                                enemyX[i] -= suctionSpeed;
-                                if (abs(enemyX[i] - player_x) < suctionSpeed)
-                                {
-                                    if (selectedLevel == 1 && backCountLevel1 < backCapLevel1)
-                                    {
-                                        backpackLevel1[backCountLevel1++] = i;
-                                        enemyDisappeared[i] = true;
-                                        enemySucked[i] = true;
-                                    }
-                                    else if (selectedLevel == 2 && backCountLevel2 < backCapLevel2)
-                                    {
-                                        backpackLevel2[backCountLevel2++] = i;
-                                        enemyDisappeared[i] = true;
-                                        enemySucked[i] = true;
-                                    }
-                                }
-                            }  
-                        } 
-                        else if (((backCountLevel1 < 3 && selectedLevel == 1) || (backCountLevel2 < 5 && selectedLevel == 2)))
-                        {
-                            enemyX[i] += suctionSpeed;
-                            if (enemyX[i] <= player_x && suctionRangeX && suctionRangeY)
-                            {
-                                if (abs(enemyX[i] - player_x) < suctionSpeed)
-                                {
-                                    if (selectedLevel == 1 && backCountLevel1 < backCapLevel1)
-                                    {
-                                        backpackLevel1[backCountLevel1++] = i;
-                                        enemyDisappeared[i] = true;
-                                        enemySucked[i] = true;
-                                    }
-                                    else if (selectedLevel == 2 && backCountLevel2 < backCapLevel2)
-                                    {
-                                        backpackLevel2[backCountLevel2++] = i;
-                                        enemyDisappeared[i] = true;
-                                        enemySucked[i] = true;
-                                    }
-                                }
-                            }
-                        }
-                    }
+    bool upPressed = false;
+    bool downPressed = false;
 
-                    // Vertical suction (up/down)
-                    else if (pressingUp && enemyY[i] <= player_y && ((backCountLevel1 < 3 && selectedLevel == 1) || (backCountLevel2 < 5 && selectedLevel == 2)))
-                    {
-                        // If Genova is attacking, vacuum has no effect on it
-                        if (enemyTypes[i] == 3 && genovaIsAttackingArr[i])
-                            continue;
-                        enemyY[i] += suctionSpeed;
-                        if (suctionRangeX && suctionRangeY)
-                        {
-                            if (abs(enemyY[i] - player_y) < suctionSpeed)
-                            {
-                                if (backCountLevel1 < backCapLevel1)
-                                {
-                                    backpackLevel1[backCountLevel1++] = i;
-                                    enemyDisappeared[i] = true;
-                                    enemySucked[i] = true;
-                                }
-                                else if (backCountLevel2 < backCapLevel2)
-                                {
-                                    backpackLevel2[backCountLevel2++] = i;
-                                    enemyDisappeared[i] = true;
-                                    enemySucked[i] = true;
-                                }
-                            }
-                        }
-                    }
-                    else if (pressingDown && enemyY[i] >= player_y && ((backCountLevel1 < 3 && selectedLevel == 1) || (backCountLevel2 < 5 && selectedLevel == 2)))
-                    {
-                        // If Genova is attacking, vacuum has no effect on it
-                        if (enemyTypes[i] == 3 && genovaIsAttackingArr[i])
-                            continue;
-                        enemyY[i] -= suctionSpeed;
+    // A level is simulated on its own thread, the loop below only renders its snapshots
+    SimThread sim;
+    sim.viewW = screen_x;
+    sim.viewH = screen_y;
+    sim.maxTicksBehind = maxTicksPerFrame;
+    bool playing = false;      // the sim thread is running and owns gs
+    bool haveSnapshot = false; // a snapshot of the current run has arrived
+    int shownLevelSerial = 0;  // level whose assets are loaded
+    bool menuShown = false;
 
-                        if (suctionRangeX && suctionRangeY)
-                        {
-                            if (abs(enemyY[i] - player_y) < suctionSpeed)
-                            {
-                                if (backCountLevel1 < backCapLevel1)
-                                {
-                                    backpackLevel1[backCountLevel1++] = i;
-                                    enemyDisappeared[i] = true;
-                                    enemySucked[i] = true;
-                                }
-                                else if (backCountLevel2 < backCapLevel2)
-                                {
-                                    backpackLevel2[backCountLevel2++] = i;
-                                    enemyDisappeared[i] = true;
-                                    enemySucked[i] = true;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    while (window.isOpen())
+    {
+        TRACE_ZONE("frame");
+        window.clear(Color::Black);
+        bool endRun = false;
 
-            if (singleThrow && !(pressingDown || pressingUp) && ((backCountLevel1 > 0 && selectedLevel == 1) || (backCountLevel2 > 0 && selectedLevel == 2)))
+        // Handle window events in both states
+        {
+            ProfScope scope(PROF_INPUT);
+            while (window.pollEvent(ev))
             {
-                throwVelocityX = 15.0f;
+                if (ev.type == Event::Closed)
+                    window.close();
+                if (ev.type == Event::KeyPressed && ev.key.code == Keyboard::F3)
+                    profiler.overlay = !profiler.overlay;
 
-                if (!facingRight && throwVelocityX > 0.0f)
+                // Pick up edited level files without restarting; a broken set keeps the old one
+                if (ev.type == Event::KeyPressed && ev.key.code == Keyboard::F5 && !playing)
                 {
-                    throwVelocityX = -throwVelocityX;
+                    vector<LevelData> reloaded;
+                    if (load_level_set(levelDir, reloaded) > 0)
+                    {
+                        levelTable = reloaded;
+                        gs.selectedLevel = min(gs.selectedLevel, (int)levelTable.size());
+                        cout << "reloaded " << levelTable.size() << " levels" << endl;
+                    }
                 }
+                // Quick-save/quick-load of the running game
+                if (ev.type == Event::KeyPressed && ev.key.code == Keyboard::F6 && playing)
+                    sim.saveRequested.store(true, memory_order_release);
+                if (ev.type == Event::KeyPressed && ev.key.code == Keyboard::F7 && playing)
+                    sim.loadRequested.store(true, memory_order_release);
+#ifdef TUMBLEPOP_TRACE
+                if (ev.type == Event::KeyPressed && ev.key.code == Keyboard::F4)
+                    trace_write("trace.json");
+#endif
+            }
+        }
 
-                int enemyIdx;
-                int monsterType;
+        // ===== MENU SCREEN =====
+        if (!playing)
+        {
+            ProfScope scope(PROF_DRAW_MENU);
 
-                if (selectedLevel == 1)
-                {
-                    enemyIdx = backpackLevel1[--backCountLevel1];
-                    monsterType = enemyTypes[enemyIdx];
-                }
-                else if (selectedLevel == 2)
-                {
-                    enemyIdx = backpackLevel2[--backCountLevel2];
-                    monsterType = enemyTypes[enemyIdx];
-                }
+            prof_draw(window, bgmenusprite);
 
-                enemyDisappeared[enemyIdx] = false;
-                enemyThrown[enemyIdx] = true;
-                enemyThrowVelocityX[enemyIdx] = throwVelocityX;
-                enemyThrowVelocityY[enemyIdx] = 0;
-                enemyX[enemyIdx] = player_x;
-                enemyY[enemyIdx] = player_y;
-                enemySucked[enemyIdx] = false;
-            }
+           /*RectangleShape titleBox(Vector2f(600, 150));
+            titleBox.setPosition(screen_x / 2 - 300, 100);
+            titleBox.setFillColor(lightWhite);
+            prof_draw(window, titleBox);*/
 
-            if (singleThrow && (pressingDown || pressingUp) && ((backCountLevel1 > 0 && selectedLevel == 1) || (backCountLevel2 > 0 && selectedLevel == 2)))
+            if (fontLoaded) // code for text load and show
             {
-                throwVelocityY = 15.0f;
-
-                if (!pressingDown && throwVelocityY > 0.0f)
-                {
-                    throwVelocityY = -throwVelocityY;
-                }
+                // titleText.setString("TUMBLE-POP");
+                // titleText.setCharacterSize(60);
+                // titleText.setFillColor(Color::White);
+                logoSprite.setTexture(*logoTex);
+                logoSprite.setScale(0.5, 0.5);
+                prof_draw(window, logoSprite);
+                logoSprite.setPosition(screen_x / 2 - 250, 200);
+            }
 
-                int enemyIdx;
-                int monsterType;
+            // Two boxes, scrolled so the selected level is always one of them
+            int levelCount = (int)levelTable.size();
+            int firstShown = max(1, min(gs.selectedLevel, levelCount - 1));
+            for (int k = 0; k < 2 && firstShown + k <= levelCount; k++)
+            {
+                int level = firstShown + k;
+                RectangleShape levelBox(Vector2f(400, 80));
+                levelBox.setPosition(screen_x / 2 - 200, 350 + 120 * k);
+                if (gs.selectedLevel == level)
+                    levelBox.setFillColor(darkBlue);
+                else
+                    levelBox.setFillColor(Color::Green);
+                prof_draw(window, levelBox);
 
-                if (selectedLevel == 1)
-                {
-                    enemyIdx = backpackLevel1[--backCountLevel1];
-                    monsterType = enemyTypes[enemyIdx];
-                }
-                else if (selectedLevel == 2)
+                if (fontLoaded)
                 {
-                    enemyIdx = backpackLevel2[--backCountLevel2];
-                    monsterType = enemyTypes[enemyIdx];
+                    levelText[k].setString("LEVEL " + to_string(level));
+                    levelText[k].setCharacterSize(40);
+                    levelText[k].setFillColor(Color::Black);
+                    levelText[k].setPosition(levelBox.getPosition().x + 120, levelBox.getPosition().y + 15);
+                    prof_draw(window, levelText[k]);
                 }
+            }
 
-                enemyDisappeared[enemyIdx] = false;
-                enemyThrown[enemyIdx] = true;
-                enemyThrowVelocityY[enemyIdx] = throwVelocityY;
-                enemyThrowVelocityX[enemyIdx] = 0;
-                enemyX[enemyIdx] = player_x;
-                enemyY[enemyIdx] = player_y;
-                enemySucked[enemyIdx] = false;
+            if (fontLoaded)
+            {
+                string instruct = "UP/DOWN to Select | SPACE to Play | ESC to Exit\n"
+                                  "F5 to Reload Levels | F6/F7 Quick Save/Load\n"
+                                  "Hold R to Rewind\n\n"
+                                  "LEFT/RIGHT for Movement\nC for Jump\n"
+                                  "W/S for Up/Down Vacuum\n"
+                                  "Q for Bulk Throw\nE for Single Throw\n"
+                                  "S + C for Drop";
+                instructText.setString(instruct);
+                instructText.setCharacterSize(20);
+                instructText.setFillColor(Color::Black);
+                instructText.setPosition(screen_x / 2 - 225, 600);
+                prof_draw(window, instructText);
             }
 
-            if (bulkThrow && !(pressingDown || pressingUp) && ((backCountLevel1 > 0 && selectedLevel == 1) || (backCountLevel2 > 0 && selectedLevel == 2)))
+            if (Keyboard::isKeyPressed(Keyboard::Up) && !upPressed)
             {
-                throwVelocityX = 15.0f;
+                if (gs.selectedLevel > 1)
+                    gs.selectedLevel--;
+                upPressed = true;
+            }
+            if (!Keyboard::isKeyPressed(Keyboard::Up))
+                upPressed = false;
 
-                // If sucked when facing left, make throw negative (ONLY if it was positive)
-                if (!facingRight && throwVelocityX > 0.0f)
-                {
-                    throwVelocityX = -throwVelocityX;
-                }
+            if (Keyboard::isKeyPressed(Keyboard::Down) && !downPressed)
+            {
+                if (gs.selectedLevel < levelCount)
+                    gs.selectedLevel++;
+                downPressed = true;
+            }
+            if (!Keyboard::isKeyPressed(Keyboard::Down))
+                downPressed = false;
 
-                int enemyIdx;
-                int monsterType;
+            if (Keyboard::isKeyPressed(Keyboard::Escape) && !escapePressed)
+            {
+                window.close();
+                escapePressed = true;
+            }
+            if (!Keyboard::isKeyPressed(Keyboard::Escape))
+                escapePressed = false;
 
-                if (selectedLevel == 1)
-                {
-                    enemyIdx = backpackLevel1[--backCountLevel1];
-                    monsterType = enemyTypes[enemyIdx];
-                }
-                else if (selectedLevel == 2)
+            if (Keyboard::isKeyPressed(Keyboard::Space) && !spacePressed)
+            {
+                newGame(gs, gs.selectedLevel, (unsigned)rand());
+                if (!recordPath.empty())
                 {
-                    enemyIdx = backpackLevel2[--backCountLevel2];
-                    monsterType = enemyTypes[enemyIdx];
+                    begin_recording(recording, gs);
+                    recordingRun = true;
                 }
-
-                enemyDisappeared[enemyIdx] = false;
-                enemyThrown[enemyIdx] = true;
-                enemyThrowVelocityX[enemyIdx] = throwVelocityX;
-                enemyThrowVelocityY[enemyIdx] = 0;
-                enemyX[enemyIdx] = player_x;
-                enemyY[enemyIdx] = player_y;
-                enemySucked[enemyIdx] = false;
+                start_sim_thread(sim, gs, liveInput, recordingRun ? &recording : nullptr);
+                playing = true;
+                haveSnapshot = false;
+                shownLevelSerial = 0;
             }
+            if (!Keyboard::isKeyPressed(Keyboard::Space))
+                spacePressed = false;
+        }
 
-            // Check if Q pressed and any monster in backpack
-            else if (bulkThrow && (pressingDown || pressingUp) && ((backCountLevel1 > 0 && selectedLevel == 1) || (backCountLevel2 > 0 && selectedLevel == 2)))
+        // ===== PLAYING SCREEN =====
+        else
+        {
+            if (Keyboard::isKeyPressed(Keyboard::Escape) && !escapePressed)
             {
-                throwVelocityY = 15.0f;
+                endRun = true;
+                escapePressed = true;
+            }
+            if (!Keyboard::isKeyPressed(Keyboard::Escape))
+                escapePressed = false;
+            sim.rewinding.store(Keyboard::isKeyPressed(Keyboard::R), memory_order_release);
+        }
 
-                if (!pressingDown && throwVelocityY > 0.0f)
+        // Pick up the newest tick. Once the run is over (game over, last level
+        // cleared or Escape) the sim thread is joined and gs is ours again.
+        if (playing)
+        {
+            if (snapshot_acquire(sim.snapshots))
+                haveSnapshot = true;
+            if (endRun || (haveSnapshot && sim.snapshots.slots[sim.snapshots.reading].gameState != 1))
+            {
+                stop_sim_thread(sim);
+                playing = false;
+                gs.gameState = 0;
+                lvlMusic.stop();
+                if (recordingRun)
                 {
-                    throwVelocityY = -throwVelocityY;
+                    end_recording(recording, gs, recordPath);
+                    recordingRun = false;
                 }
+            }
+        }
+        const RenderSnapshot &snap = sim.snapshots.slots[sim.snapshots.reading];
 
-                int enemyIdx;
-                int monsterType;
+        // startLevel ran (from the menu or from level progression), swap in the level's assets
+        if (playing && haveSnapshot && snap.levelSerial != shownLevelSerial)
+        {
+            ProfScope scope(PROF_LEVEL_LOAD);
+            loadLevelAssets(levelTable[snap.selectedLevel - 1], cache, bgSprite, atlas, tileFrames);
+            build_tile_chunks(tileChunks, *snap.tiles, tileFrames, cell_size);
+            level_cache_reset(levelCache, *snap.tiles, cell_size, screen_x, screen_y);
+            lvlMusic.play();
+            lvlMusic.setLoop(true);
+            spacePressed = true;
+            shownLevelSerial = snap.levelSerial;
+        }
 
-                if (selectedLevel == 1)
-                {
-                    enemyIdx = backpackLevel1[--backCountLevel1];
-                    monsterType = enemyTypes[enemyIdx];
-                }
-                else if (selectedLevel == 2)
-                {
-                    enemyIdx = backpackLevel2[--backCountLevel2];
-                    monsterType = enemyTypes[enemyIdx];
-                }
+        if (playing && haveSnapshot)
+        {
+            int heartDistance = 64;
+            int heartPosition = -54;
+
+            // Positions are blended between the last two ticks, see snapshot_alpha
+            float alpha = snapshot_alpha(snap, TICK_DT);
+            float player_x = interpolate(snap.prevPlayerX, snap.player_x, alpha);
+            float player_y = interpolate(snap.prevPlayerY, snap.player_y, alpha);
+            const GameInput &in = snap.input;
 
-                enemyDisappeared[enemyIdx] = false;
-                enemyThrown[enemyIdx] = true;
-                enemyThrowVelocityY[enemyIdx] = throwVelocityY;
-                enemyThrowVelocityX[enemyIdx] = 0;
-                enemyX[enemyIdx] = player_x;
-                enemyY[enemyIdx] = player_y;
-                enemySucked[enemyIdx] = false;
+            switch (snap.playerPose)
+            {
+            case POSE_LEFT:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameLeft);
+                break;
+            case POSE_UP:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameUp);
+                break;
+            case POSE_DOWN:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameDown);
+                break;
+            case POSE_JUMP_RIGHT:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameJumpRight);
+                break;
+            case POSE_JUMP_LEFT:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameJumpLeft);
+                break;
+            default:
+                set_atlas_frame(PlayerSprite, atlas, PlayerFrameRight);
+                break;
             }
 
-            const int enemySize = 64;
-            for (int ei = 0; ei < MAX_ENEMIES; ei++)
+            // The world is drawn through the camera, the HUD straight to the screen
+            View camera(FloatRect(0, 0, screen_x, screen_y));
+            camera.setCenter(interpolate(snap.prevCameraX, snap.cameraX, alpha),
+                             interpolate(snap.prevCameraY, snap.cameraY, alpha));
             {
-                if (!enemyThrown[ei])
-                    continue;
+                ProfScope scope(PROF_DRAW_LEVEL);
+                display_level(window, levelCache, bgSprite, tileChunks, atlas, tileFrames, camera, cell_size);
+            }
 
-                if (enemyThrowVelocityX[ei] != 0)
+            {
+                ProfScope scope(PROF_DRAW_SPRITES);
+                if (!snap.victoryAnimation)
                 {
-                    float nextX = enemyX[ei] + enemyThrowVelocityX[ei];
-                    int enemyRowTop = (int)(enemyY[ei] / cell_size);
-                    int enemyRowMid = (int)((enemyY[ei] + enemySize / 2) / cell_size);
-                    int enemyRowBottom = (int)((enemyY[ei] + enemySize - 1) / cell_size);
-                    int enemyCol;
+                    PlayerSprite.setPosition(player_x, player_y);
 
-                    if (enemyThrowVelocityX[ei] > 0)
+                    if (in.movingLeft && snap.onGround)
                     {
-                        enemyCol = (int)((nextX + enemySize) / cell_size);
+                        int frameIndex = (snap.walkframe / 20) % 4; // Frames 0-3
+                        walk_sprite[frameIndex].setPosition(player_x, player_y);
+                        walk_sprite[frameIndex].setScale(2, 2);
+                        prof_draw(window, walk_sprite[frameIndex]);
                     }
-                    else
-                    {
-                        enemyCol = (int)(nextX / cell_size);
-                    }
-
-                    char tileTop = getTile(lvl, enemyRowTop, enemyCol, height, width);
-                    char tileMid = getTile(lvl, enemyRowMid, enemyCol, height, width);
-                    char tileBottom = getTile(lvl, enemyRowBottom, enemyCol, height, width);
-
-                    if (tileTop == '#' || tileTop == '/' || tileTop == '\\' ||
-                        tileMid == '#' || tileMid == '/' || tileMid == '\\' ||
-                        tileBottom == '#' || tileBottom == '/' || tileBottom == '\\')
+                    else if (in.movingRight && snap.onGround)
                     {
-                        enemyDisappeared[ei] = true;
-                        enemyThrown[ei] = false;
+                        int frameIndex = 4 + ((snap.walkframe / 20) % 4); // Frames 4-7
+                        walk_sprite[frameIndex].setPosition(player_x, player_y);
+                        walk_sprite[frameIndex].setScale(2, 2);
+                        prof_draw(window, walk_sprite[frameIndex]);
                     }
                     else
                     {
-                        enemyX[ei] = nextX;
+                        prof_draw(window, PlayerSprite);
                     }
                 }
-                else if (enemyThrowVelocityY[ei] != 0)
-                {
-                    float nextY = enemyY[ei] + enemyThrowVelocityY[ei];
-                    int enemyColLeft = (int)(enemyX[ei] / cell_size);
-                    int enemyColMid = (int)((enemyX[ei] + enemySize / 2) / cell_size);
-                    int enemyColRight = (int)((enemyX[ei] + enemySize - 1) / cell_size);
-                    int enemyRow;
 
-                    if (enemyThrowVelocityY[ei] > 0)
-                    {
-                        enemyRow = (int)((nextY + enemySize) / cell_size);
+                // Only enemies near the view, culled when the snapshot was taken
+                for (const SnapshotEnemy &e : snap.enemies)
+                {
+                    float ex = interpolate(e.prevX, e.x, alpha);
+                    float ey = interpolate(e.prevY, e.y, alpha);
+
+                    if (e.type == 0)
+                    { // Ghost
+                        // Ensure correct facing per enemy
+                        if (e.goingRight)
+                            set_atlas_frame(ghostSpr, atlas, ghostRightFrame);
+                        else
+                            set_atlas_frame(ghostSpr, atlas, ghostLeftFrame);
+
+                        ghostSpr.setPosition(ex, ey);
+                        drawGhost(window, ghostSpr);
                     }
-                    else
-                    {
-                        enemyRow = (int)(nextY / cell_size);
+                    else if (e.type == 1)
+                    { // Skeleton
+                        // Use per-enemy direction for texture
+                        if (e.goingRight)
+                            set_atlas_frame(skelSpr, atlas, skelRightFrame);
+                        else
+                            set_atlas_frame(skelSpr, atlas, skelLeftFrame);
+
+                        skelSpr.setPosition(ex, ey);
+                        drawskel(window, skelSpr);
                     }
-
-                    char tileLeft = getTile(lvl, enemyRow, enemyColLeft, height, width);
-                    char tileMid = getTile(lvl, enemyRow, enemyColMid, height, width);
-                    char tileRight = getTile(lvl, enemyRow, enemyColRight, height, width);
-
-                    if (tileLeft == '#' || tileLeft == '/' || tileLeft == '\\' ||
-                        tileMid == '#' || tileMid == '/' || tileMid == '\\' ||
-                        tileRight == '#' || tileRight == '/' || tileRight == '\\')
-                    {
-                        enemyDisappeared[ei] = true;
-                        enemyThrown[ei] = false;
+                    else if (e.type == 2)
+                    { // Invisible Man
+                        // Invisible man uses its own appearing logic; ensure texture matches direction
+                        if (e.goingRight)
+                            set_atlas_frame(invisSpr, atlas, invisRightFrame);
+                        else
+                            set_atlas_frame(invisSpr, atlas, invisLeftFrame);
+
+                        invisSpr.setPosition(ex, ey);
+                        drawinvisibleman(window, invisSpr, snap.isInvisible, snap.Disappearing,
+                                         snap.invisDisappearFrame, Disappear_spr);
                     }
-                    else
-                    {
-                        enemyY[ei] = nextY;
+                    else if (e.type == 3)
+                    { // Genova
+                        // Use per-enemy direction rather than the single global
+                        bool facing = e.goingRight;
+                        if (facing)
+                            set_atlas_frame(genovaSpr, atlas, genovaRightFrame);
+                        else
+                            set_atlas_frame(genovaSpr, atlas, genovaLeftFrame);
+
+                        genovaSpr.setPosition(ex, ey);
+                        drawGenova(window, genovaSpr, e.genovaIsAttacking, facing,
+                                   e.genovaAttackFrame, genova_sprite, ex, ey);
                     }
                 }
-            }
-
-            // Reduce cooldown
-            if (damageCooldown > 0.0f)
-            {
-                damageCooldown -= 1.0f / 60.0f;
-            }
-
-            // Reduce life and increase cool down if monster in proximity
-            bool anyThrown = false;
-            for (int ti = 0; ti < MAX_ENEMIES; ti++)
-                if (enemyThrown[ti])
-                {
-                    anyThrown = true;
-                    break;
-                }
-
-            // If any per-enemy fireball actually hit the player, treat as damage
-            bool anyFireballHit = false;
-            for (int fi = 0; fi < MAX_ENEMIES; fi++)
-                if (fireballHitArr[fi])
-                {
-                    anyFireballHit = true;
-                    break;
-                }
-
-            if (!vacuum && (activeMonsterCollision || anyFireballHit) && (!anyThrown) &&
-                damageCooldown <= 0.0f)
-            {
-                // Reduce life till -1 (to check for last life)
-                if (lifeCount > -1)
-                {
-                    lifeCount -= 1;
-                }
-                damageCooldown = 2.0f;
-            }
-
-            // Clear fireball hit flags after applying damage so single hit counts once
-            if (anyFireballHit)
-            {
-                for (int fi = 0; fi < MAX_ENEMIES; fi++)
-                    fireballHitArr[fi] = false;
-            }
-
-            window.draw(playerLogoSpr);
-            window.draw(playerNumSpr);
-
-            // Display lives at a distance according to life count
-            for (int i = 0; i < lifeCount; ++i)
-            {
-                window.draw(heartSpr[i]);
-                heartSpr[i].setPosition(heartPosition + heartDistance, heartDistance);
-                heartPosition += 64 + 10;
-            }
 
-            // Level progression from 1 to 2, and 2 to main menu
-            bool allEnemiesGone = true;
-            for (int i = 0; i < MAX_ENEMIES; i++)
-            {
-                if (!enemyDisappeared[i])
-                {
-                    allEnemiesGone = false;
-                    break;
-                }
-            }
-            if (!victoryAnimation && allEnemiesGone && ((backCountLevel1 == 0 && selectedLevel == 1) || (backCountLevel2 == 0 && selectedLevel == 2)))
-            {
-                victoryAnimation = true;
-                victoryTimer = 0.0;
+                draw_projectiles(window, snap.projectileX, snap.projectileY, snap.projectilePrevX, snap.projectilePrevY, alpha,
+                                 atlas, fireballFrames[snap.vacuumframe / 5], 1.8f, camera, projectileBatch);
             }
 
-            if (victoryAnimation)
             {
-                victoryTimer += 1 / 60.0f;
-                int animIndex = (int)(victoryTimer / 0.25f) % 4;
-                victorySpr[animIndex].setScale(2, 2);
-                victorySpr[animIndex].setPosition(player_x, player_y);
-                window.draw(victorySpr[animIndex]);
-
-                if (victoryTimer > 4.0f)
+                ProfScope scope(PROF_DRAW_HUD);
+                if (in.vacuum && !snap.victoryAnimation)
                 {
-                    victoryAnimation = false;
-
-                    if (selectedLevel == 1)
-                    {
-                        backCountLevel1 = 0;
-                        backCountLevel2 = 0;
-                        selectedLevel = 2;
-                        startLevel(selectedLevel, height, width, lifeCount, player_x, player_y, velocityY, onGround, damageCooldown, dropCooldown,
-                                lvl, bgTex, bgSprite, blockTexture, blockSprite, oneWayTexture, oneWaySprite,
-                                slopeTexture, slopeSprite, slopeBotTexture, slopeBotSprite, spacePressed, lvlMusic,
-                                enemyTypes, enemyX, enemyY, enemyDisappeared, enemySucked, enemyThrown, 
-                                enemyVelocityY, enemyGoingRight, enemyThrowVelocityX, enemyThrowVelocityY, 
-                                MAX_ENEMIES, cell_size);
-                    }
-                    else if (selectedLevel == 2)
+                    for (int i = 0; i < 4; i++) // loop for vacum animation 
                     {
-                        gameState = 0;
-                        lvlMusic.stop();
+                        if (snap.facingRight)
+                        {
+                            prof_draw(window, rainbow_sprite[(snap.vacuumframe / 5) + 4]);
+                            rainbow_sprite[i + 4].setPosition(player_x + 60, player_y + 25);
+                        }
+                        else if (in.pressingUp)
+                        {
+                            prof_draw(window, rainbow_sprite[(snap.vacuumframe / 5) + 8]);
+                            rainbow_sprite[i + 8].setPosition(player_x - 5, player_y - 53);
+                        }
+                        else if (in.pressingDown)
+                        {
+                            prof_draw(window, rainbow_sprite[(snap.vacuumframe / 5) + 12]);
+                            rainbow_sprite[i + 12].setPosition(player_x - 2, player_y + 69);
+                        }
+                        else
+                        {
+                            prof_draw(window, rainbow_sprite[snap.vacuumframe / 5]);
+                            rainbow_sprite[i].setPosition(player_x - 50, player_y + 25);
+                        }
                     }
                 }
-            }
 
-            // Go to main menu and reset after negative life count
-            if (lifeCount < 0)
-            {
-                for (int i = 0; i < 3; ++i)
+                window.setView(window.getDefaultView());
+                prof_draw(window, playerLogoSpr);
+                prof_draw(window, playerNumSpr);
+
+                // Display lives at a distance according to life count
+                for (int i = 0; i < snap.lifeCount; ++i)
                 {
-                    backpackLevel1[i] = 4; // 4 is not any monster's ID
+                    prof_draw(window, heartSpr[i]);
+                    heartSpr[i].setPosition(heartPosition + heartDistance, heartDistance);
+                    heartPosition += 64 + 10;
                 }
 
-                for (int i = 0; i < 3; ++i)
+                if (snap.victoryAnimation)
                 {
-                    backpackLevel2[i] = 4;
+                    window.setView(camera);
+                    int animIndex = (int)(snap.victoryTimer / 0.25f) % 4;
+                    victorySpr[animIndex].setScale(2, 2);
+                    victorySpr[animIndex].setPosition(player_x, player_y);
+                    prof_draw(window, victorySpr[animIndex]);
                 }
-
-                backCountLevel1 = 0;
-                backCountLevel2 = 0;
-                gameState = 0;
-                lvlMusic.stop();
             }
+            window.setView(window.getDefaultView());
         }
 
-        window.display();
+        if (profiler.overlay)
+            draw_profiler_overlay(window, font, fontLoaded);
+
+        {
+            ProfScope scope(PROF_DISPLAY);
+            TRACE_ZONE("display");
+            window.display();
+        }
+        prof_end_frame();
+        if (!menuShown)
+        {
+            cout << "time to first frame: "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - launchTime).count() << " ms" << endl;
+            menuShown = true;
+        }
     }
 
+    if (playing)
+        stop_sim_thread(sim);
     lvlMusic.stop();
-    for (int i = 0; i < height; i++)
-        delete[] lvl[i];
-    delete[] lvl;
+    if (recordingRun)
+        end_recording(recording, gs, recordPath);
+    print_cache_stats(cache);
+#ifdef TUMBLEPOP_TRACE
+    trace_write("trace.json");
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
+#endif